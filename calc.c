@@ -1,5 +1,25 @@
 // Ilkim Sonal 211ADB102
-// Compile with: gcc -O2 -Wall -Wextra -std=c17 -o calc calc.c -lm
+// Compile with: gcc -O2 -Wall -Wextra -std=c17 -pthread -o calc calc.c -lm
+//   (zstd inputs: add -DCALC_WITH_ZSTD ... -lzstd;
+//    --check-noalloc: add -DCALC_ALLOC_CHECK, glibc only;
+//    one calc run per expression: add -static, which skips loading libc/libm
+//    and cuts exec-to-exit time by ~40%; calc_bench --startup measures it
+//    against a 300us budget, see its header)
+// PGO+LTO build (GCC 10+), trained on calc_gen workloads that mix directory,
+// single-file and --ndjson runs, ints/floats and error inputs. Keep -o calc in
+// both compiles: the .gcda profile is named after the output. From a clean
+// checkout:
+//   gcc -O2 -Wall -Wextra -std=c17 -o calc_gen calc_gen.c -lm
+//   mkdir -p T
+//   gcc -O2 -flto -fprofile-generate -pthread -o calc calc.c -lm
+//   ./calc_gen --dir T/d --count 20000 --size-dist pareto --error-rate 0.05
+//   ./calc_gen --file T/big.txt --count 50000
+//   ./calc_gen --ndjson T/r.json --count 100000 --float-ratio 0.5 --error-rate 0.05
+//   ./calc -d T/d -o T/o; ./calc T/big.txt -o T/o; ./calc --ndjson T/r.json >/dev/null
+//   gcc -O2 -flto -fprofile-use -fprofile-partial-training -pthread -o calc calc.c -lm
+// Compare with calc_bench --startup on both binaries, and for the stages
+// build calc_bench the same way (trained on its own run) against a plain
+// -O2 calc_bench's --json baseline.
 //
 // -----------------------------------------------------------------------------
 // WHAT THIS PROGRAM DOES (brief):
@@ -11,16 +31,70 @@
 // - CLI:
 //   calc [-d DIR|--dir DIR] [-o OUTDIR|--output-dir OUTDIR] input.txt
 //   • If -d is given, processes all *.txt files in DIR (non-recursive).
+//   • gzip/zstd-compressed inputs (detected by magic bytes; *.txt.gz and
+//     *.txt.zst are picked up by -d) are decoded in memory. They share the
+//     plain name's output, so next to task1.txt a task1.txt.gz is an error.
+//   • --zip ARCHIVE evaluates every *.txt member of a zip (stored/deflate)
+//     without extracting it; output names come from the member base names,
+//     and a member whose base name was already used (a/x.txt, b/x.txt) is
+//     an error.
 //   • If -o omitted, output dir becomes: <input_base>_<username>_<STUDENT_ID>/
 //   • For each input task1.txt -> task1_<Name>_<Lastname>_<StudentID>.txt
+//   • --durability none|atomic|durable selects how results are committed
+//     (in place / temp file + rename / plus batched fsync).
+//   • --if-changed leaves an output untouched if it already has the same
+//     content, and reports how many writes were skipped.
+//   • --format bin writes all results as fixed-width records into one file
+//     (layout in calcbin.h); --bin-to-text converts it back to text outputs.
+//   • calc --ndjson [FILE|-] streams JSON records: the "expr" string of each
+//     is evaluated and the record is printed with "result"/"error_pos" added.
+//     Output stays line-for-line with the input: a line that is not an
+//     object becomes {"line":N,"error":"not a JSON object"}.
+//   • --aggregate sum,min,max,mean,count,errors prints only a summary of the
+//     results (exact integer sum, compensated float sum) and writes no files.
+//   • --stats[=json] reports time per phase (read, lex+parse/eval, format,
+//     output) and file/byte/token/expression/error counters.
+//   • --perf-counters adds hardware counters per phase (perf_event_open);
+//     if they are unavailable, calc says so and carries on.
+//   • --trace OUT.json records per-file and per-stage spans (per-thread
+//     buffers) and writes them in Chrome trace-event format at exit.
+//   • --latency reports per-file / per-record latency percentiles from
+//     log-linear histograms, plus the slowest inputs.
+//   • --mem-stats counts allocations/bytes per call site, reports peak RSS
+//     and exits non-zero if a buffer was never freed.
+//   • --check-noalloc (ALLOC_CHECK builds) proves evaluation makes no heap
+//     calls: malloc & co. are interposed and counted over a batch.
+//   • --profile-ops counts and times each arithmetic operation by operand
+//     types and lists the inputs that spend the most time in operations.
+//   • --slow-log FILE [--slow-threshold 5ms] logs every input whose
+//     evaluation is that slow, with its size, token count and paren depth.
+//   • kill -USR1 prints progress (files done/total, MB/s, expr/s, errors,
+//     ETA) to stderr; --progress-interval T prints it every T.
+//   • --metrics FILE.prom keeps a Prometheus textfile-collector snapshot
+//     (counters, errors by kind, latency histogram) atomically up to date.
+//   • calc --verify DIR [--jobs N] checks every NAME.txt / NAME_output.txt
+//     pair in DIR in memory on N threads and reports failures and timings
+//     (the per-file instrumentation flags are refused in this mode).
+//   • Scanner kernels are picked at startup for the CPU (scalar, SSE4.2,
+//     AVX2, AVX-512BW); --cpu-features shows the choice, --isa forces one.
 // - Division by zero: we report ERROR at the '/' token position (documented).
-// - Single source file; uses only standard C/POSIX headers (no bison/flex).
+// - Nesting of '(' and '**' deeper than CALC_MAX_DEPTH (1000; -D to change) is
+//   an ERROR at the token that crosses it, instead of exhausting the stack.
+// - Single source file (+ calcbin.h for the binary result layout); uses only
+//   standard C/POSIX headers (no bison/flex). Linux/glibc extras (O_TMPFILE,
+//   malloc_usable_size, strverscmp, perf_event_open) sit behind feature
+//   checks with a fallback, so the file also builds on other POSIX systems.
+//   calc_bench.c builds the stage microbenchmarks on top of this file (compile
+//   line in its header), and calc_gen.c writes seeded synthetic workloads
+//   (-d, --zip, --ndjson, input).
 // -----------------------------------------------------------------------------
 
 #define STUDENT_NAME     "Ilkim"
 #define STUDENT_LASTNAME "Sonal"
 #define STUDENT_ID       "211ADB102"
 
+#define _GNU_SOURCE   // openat, dirfd, O_DIRECTORY, O_TMPFILE, linkat
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -28,8 +102,38 @@
 #include <errno.h>
 #include <math.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/resource.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#define CALC_MEM_SIZE(p) malloc_usable_size(p)
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#define CALC_MEM_SIZE(p) malloc_size(p)
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+#include <time.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "calcbin.h"
+#ifdef CALC_WITH_ZSTD
+#include <zstd.h>
+#endif
 
 // ============================ Value (int/double) =============================
 // Represents a number that can be either integer or floating-point.
@@ -71,6 +175,227 @@ static Value v_pow(Value base, Value exp){
     return make_double(pow(bd, ed));
 }
 
+// ============================ Operation profile =============================
+// --profile-ops: the parser routes every arithmetic operation through prof_op,
+// which counts it by kind and operand types (int, float, or mixed, i.e. an
+// int promoted to float) and times it with the cycle counter. Off, that is
+// one predictable branch per operation. Counters are per thread (t_ops); the
+// report side lives after the Latency section.
+typedef enum { OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_POW, OP_NEG, OP_N } OpKind;
+typedef enum { OPS_INT, OPS_FLOAT, OPS_MIXED, OPS_N } OpOperands;
+static const char *const op_names[OP_N] = { "add", "sub", "mul", "div", "pow", "neg" };
+static const char *const op_operand_names[OPS_N] = { "int", "float", "mixed" };
+
+typedef struct {
+    unsigned long long count[OP_N][OPS_N], ticks[OP_N][OPS_N];
+    unsigned long long expr_ticks, expr_ops;   // current expression
+} OpCounts;
+
+static int g_prof_on;
+static _Thread_local OpCounts *t_ops;
+
+// Raw TSC ticks where available (a few ns to read), else CLOCK_MONOTONIC ns
+static inline unsigned long long op_ticks(void){
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec t; clock_gettime(CLOCK_MONOTONIC, &t);
+    return (unsigned long long)t.tv_sec * 1000000000ULL + (unsigned long long)t.tv_nsec;
+#endif
+}
+
+// Applies op k (b is ignored for OP_NEG; err_pos/pos only matter for OP_DIV)
+static Value prof_op(OpKind k, Value a, Value b, size_t *err_pos, size_t pos){
+    unsigned long long t0 = op_ticks();
+    Value r;
+    switch(k){
+    case OP_ADD: r = v_add(a, b); break;
+    case OP_SUB: r = v_sub(a, b); break;
+    case OP_MUL: r = v_mul(a, b); break;
+    case OP_DIV: r = v_div(a, b, err_pos, pos); break;
+    case OP_POW: r = v_pow(a, b); break;
+    default:     r = a.is_float ? make_double(-a.d) : make_int(-a.i); b = a; break;
+    }
+    unsigned long long dt = op_ticks() - t0;
+    OpCounts *c = t_ops;
+    if(c){
+        OpOperands o = a.is_float!=b.is_float ? OPS_MIXED : a.is_float ? OPS_FLOAT : OPS_INT;
+        c->count[k][o]++; c->ticks[k][o] += dt;
+        c->expr_ticks += dt; c->expr_ops++;
+    }
+    return r;
+}
+
+// =============================== CPU dispatch ===============================
+// The scanner's byte loops (runs of blanks, the rest of a '#' comment line)
+// have one kernel per instruction set. cpu_select() fills g_kern once at
+// startup with the widest level this CPU supports up to AVX2, or with the
+// level named by --isa so every variant can be tested on one machine.
+// AVX-512BW is opt-in: on comment lines of tens to thousands of bytes it
+// measured no faster than AVX2, and on some CPUs it costs clock speed. Until
+// cpu_select() runs, g_kern is the scalar set, the only one off x86.
+typedef enum { ISA_SCALAR, ISA_SSE42, ISA_AVX2, ISA_AVX512, ISA_N } Isa;
+static const char *const isa_names[ISA_N] = { "scalar", "sse4.2", "avx2", "avx512bw" };
+
+static int is_blank(unsigned char c){ return c==' ' || c=='\t' || c=='\r' || c=='\n'; }
+
+// Length of the run of blanks at p, and offset of the first '\n' (n if none)
+static size_t blank_run_scalar(const char *p, size_t n){
+    size_t i = 0;
+    while(i<n && is_blank((unsigned char)p[i])) i++;
+    return i;
+}
+static size_t line_end_scalar(const char *p, size_t n){
+    size_t i = 0;
+    while(i<n && p[i]!='\n') i++;
+    return i;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse4.2")))
+static size_t blank_run_sse42(const char *p, size_t n){
+    const __m128i set = _mm_setr_epi8(' ', '\t', '\r', '\n', 0,0,0,0,0,0,0,0,0,0,0,0);
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16){
+        int k = _mm_cmpestri(set, 4, _mm_loadu_si128((const __m128i*)(p + i)), 16,
+                             _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_NEGATIVE_POLARITY);
+        if(k < 16) return i + (size_t)k;
+    }
+    return i + blank_run_scalar(p + i, n - i);
+}
+__attribute__((target("sse4.2")))
+static size_t line_end_sse42(const char *p, size_t n){
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16){
+        int m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + i)), nl));
+        if(m) return i + (size_t)__builtin_ctz((unsigned)m);
+    }
+    return i + line_end_scalar(p + i, n - i);
+}
+
+// The wide kernels look at the first 16 bytes first: most blank runs and
+// comment lines end there, and a full-width load would be wasted on them
+__attribute__((target("sse4.2")))
+static unsigned blank_mask16(const char *p){
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    __m128i b = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+                             _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))));
+    return ~(unsigned)_mm_movemask_epi8(b) & 0xffff;   // set bits: not blank
+}
+__attribute__((target("sse4.2")))
+static unsigned nl_mask16(const char *p){
+    return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), _mm_set1_epi8('\n')));
+}
+
+__attribute__((target("avx2")))
+static size_t blank_run_avx2(const char *p, size_t n){
+    const __m256i sp = _mm256_set1_epi8(' '), tb = _mm256_set1_epi8('\t'), cr = _mm256_set1_epi8('\r'), lf = _mm256_set1_epi8('\n');
+    size_t i = 0;
+    if(n >= 16){ unsigned m = blank_mask16(p); if(m) return (size_t)__builtin_ctz(m); i = 16; }
+    for(; i + 32 <= n; i += 32){
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+        __m256i b = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, sp), _mm256_cmpeq_epi8(v, tb)),
+                                    _mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, lf)));
+        unsigned m = ~(unsigned)_mm256_movemask_epi8(b);
+        if(m) return i + (size_t)__builtin_ctz(m);
+    }
+    return i + blank_run_scalar(p + i, n - i);
+}
+__attribute__((target("avx2")))
+static size_t line_end_avx2(const char *p, size_t n){
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t i = 0;
+    if(n >= 16){ unsigned m = nl_mask16(p); if(m) return (size_t)__builtin_ctz(m); i = 16; }
+    for(; i + 32 <= n; i += 32){
+        unsigned m = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + i)), nl));
+        if(m) return i + (size_t)__builtin_ctz(m);
+    }
+    return i + line_end_scalar(p + i, n - i);
+}
+
+__attribute__((target("avx512bw")))
+static size_t blank_run_avx512(const char *p, size_t n){
+    const __m512i sp = _mm512_set1_epi8(' '), tb = _mm512_set1_epi8('\t'), cr = _mm512_set1_epi8('\r'), lf = _mm512_set1_epi8('\n');
+    size_t i = 0;
+    if(n >= 16){ unsigned m = blank_mask16(p); if(m) return (size_t)__builtin_ctz(m); i = 16; }
+    for(; i + 64 <= n; i += 64){
+        __m512i v = _mm512_loadu_si512((const void*)(p + i));
+        __mmask64 b = _mm512_cmpeq_epi8_mask(v, sp) | _mm512_cmpeq_epi8_mask(v, tb) |
+                      _mm512_cmpeq_epi8_mask(v, cr) | _mm512_cmpeq_epi8_mask(v, lf);
+        if(~b) return i + (size_t)__builtin_ctzll(~b);
+    }
+    return i + blank_run_scalar(p + i, n - i);
+}
+__attribute__((target("avx512bw")))
+static size_t line_end_avx512(const char *p, size_t n){
+    const __m512i nl = _mm512_set1_epi8('\n');
+    size_t i = 0;
+    if(n >= 16){ unsigned m = nl_mask16(p); if(m) return (size_t)__builtin_ctz(m); i = 16; }
+    for(; i + 64 <= n; i += 64){
+        __mmask64 m = _mm512_cmpeq_epi8_mask(_mm512_loadu_si512((const void*)(p + i)), nl);
+        if(m) return i + (size_t)__builtin_ctzll(m);
+    }
+    return i + line_end_scalar(p + i, n - i);
+}
+#endif
+
+typedef struct {
+    size_t (*blank_run)(const char *p, size_t n);
+    size_t (*line_end)(const char *p, size_t n);
+} Kernels;
+
+static const Kernels isa_kernels[ISA_N] = {
+    { blank_run_scalar, line_end_scalar },
+#if defined(__x86_64__) || defined(__i386__)
+    { blank_run_sse42,  line_end_sse42 },
+    { blank_run_avx2,   line_end_avx2 },
+    { blank_run_avx512, line_end_avx512 },
+#endif
+};
+static Kernels g_kern = { blank_run_scalar, line_end_scalar };
+static Isa g_isa = ISA_SCALAR;
+
+static int isa_supported(Isa i){
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    switch(i){
+    case ISA_SCALAR: return 1;
+    case ISA_SSE42:  return __builtin_cpu_supports("sse4.2");
+    case ISA_AVX2:   return __builtin_cpu_supports("avx2");
+    case ISA_AVX512: return __builtin_cpu_supports("avx512bw");
+    default:         return 0;
+    }
+#else
+    return i==ISA_SCALAR;
+#endif
+}
+
+// Picks the widest supported level up to AVX2, or the one named by force; -1
+// if force is unknown or not supported here
+static int cpu_select(const char *force){
+    Isa pick = ISA_SCALAR;
+    if(force){
+        int k = 0;
+        while(k<ISA_N && strcmp(force, isa_names[k])!=0) k++;
+        if(k==ISA_N){ fprintf(stderr,"isa fail: unknown level %s\n", force); return -1; }
+        if(!isa_supported((Isa)k)){ fprintf(stderr,"isa fail: %s not supported by this CPU\n", force); return -1; }
+        pick = (Isa)k;
+    } else {
+        for(int k=ISA_AVX2;k>0;k--) if(isa_supported((Isa)k)){ pick = (Isa)k; break; }
+    }
+    g_isa = pick; g_kern = isa_kernels[pick];
+    return 0;
+}
+
+// --cpu-features: what the CPU has and what each kernel runs
+static void cpu_report(FILE *f){
+    fputs("cpu:", f);
+    for(int k=1;k<ISA_N;k++) fprintf(f, " %s=%s", isa_names[k], isa_supported((Isa)k) ? "yes" : "no");
+    fprintf(f, "\nselected: %s\n", isa_names[g_isa]);
+    fprintf(f, "  blank_run  %s\n  line_end   %s\n", isa_names[g_isa], isa_names[g_isa]);
+}
+
 // ================================ Tokenizer =================================
 // Tokenizer converts input characters into tokens for parsing arithmetic.
 
@@ -93,6 +418,9 @@ typedef struct {
     size_t pos;       // Current position (1-based)
     size_t idx0;      // Index in the string (0-based)
     size_t err_pos;   // Error position (if any)
+    int    div_zero;  // the error is a division by zero
+    int    depth;     // open '(' plus pending '**' right operands
+    unsigned long long ntokens;   // tokens handed to the parser (for --stats)
     Token  cur;       // Current token
 } Scanner;
 
@@ -102,16 +430,18 @@ static void set_error(Scanner *S, size_t p){ if(!S->err_pos) S->err_pos = p; }
 // Skips whitespace and full-line comments (#)
 static void skip_ws_and_comments(Scanner *S){
     for(;;){
-        // Skip spaces, tabs, newlines
-        while(S->idx0 < S->len && (
-            S->src[S->idx0]==' '  ||
-            S->src[S->idx0]=='\t' ||
-            S->src[S->idx0]=='\r' ||
-            S->src[S->idx0]=='\n'
-        )){ S->idx0++; S->pos++; }
+        // Skip spaces, tabs, newlines; a lone blank (the common case) needs
+        // no kernel call
+        if(S->idx0 < S->len && is_blank((unsigned char)S->src[S->idx0])){
+            size_t k = 1;
+            if(S->idx0 + 1 < S->len && is_blank((unsigned char)S->src[S->idx0 + 1]))
+                k = g_kern.blank_run(S->src + S->idx0, S->len - S->idx0);
+            S->idx0 += k; S->pos += k;
+        }
         // Skip lines starting with '#'
         if(S->idx0 < S->len && S->src[S->idx0]=='#'){
-            while(S->idx0 < S->len && S->src[S->idx0] != '\n'){ S->idx0++; S->pos++; }
+            size_t k = g_kern.line_end(S->src + S->idx0, S->len - S->idx0);
+            S->idx0 += k; S->pos += k;
             continue;
         }
         break;
@@ -173,7 +503,7 @@ static Token next_token(Scanner *S){
     // Unknown character
     S->idx0++; S->pos++; return make_simple(T_INVALID, p);
 }
-static void advance(Scanner *S){ S->cur = next_token(S); }
+static void advance(Scanner *S){ S->cur = next_token(S); S->ntokens += S->cur.type != T_EOF; }
 
 // ================================= Parser ===================================
 // Recursive-descent parser for arithmetic grammar.
@@ -183,6 +513,12 @@ static void advance(Scanner *S){ S->cur = next_token(S); }
 //   power := unary ( '**' power )?      // right-associative
 //   unary := ('+'|'-') unary | primary
 //   primary := NUMBER | '(' expr ')'
+// Unary chains are a loop; '(' and '**' recurse, so their combined nesting is
+// capped at CALC_MAX_DEPTH (about 800 bytes of stack per level) and deeper
+// input is an ERROR at the '(' or '**' that crosses the limit.
+#ifndef CALC_MAX_DEPTH
+#define CALC_MAX_DEPTH 1000
+#endif
 
 // Forward declarations
 static Value parse_expr(Scanner *S);
@@ -197,7 +533,8 @@ static Value parse_expr(Scanner *S){
     while(S->cur.type==T_PLUS || S->cur.type==T_MINUS){
         TokType op = S->cur.type; advance(S);
         Value r = parse_term(S); if(S->err_pos) return make_int(0);
-        v = (op==T_PLUS)? v_add(v,r) : v_sub(v,r);
+        if(g_prof_on) v = prof_op(op==T_PLUS ? OP_ADD : OP_SUB, v, r, NULL, 0);
+        else v = (op==T_PLUS)? v_add(v,r) : v_sub(v,r);
     }
     return v;
 }
@@ -208,8 +545,9 @@ static Value parse_term(Scanner *S){
     while(S->cur.type==T_STAR || S->cur.type==T_SLASH){
         TokType op = S->cur.type; size_t slash_pos = S->cur.start_pos; advance(S);
         Value r = parse_power(S); if(S->err_pos) return make_int(0);
-        v = (op==T_STAR)? v_mul(v,r) : v_div(v,r,&S->err_pos,slash_pos);
-        if(S->err_pos) return make_int(0);
+        if(g_prof_on) v = prof_op(op==T_STAR ? OP_MUL : OP_DIV, v, r, &S->err_pos, slash_pos);
+        else v = (op==T_STAR)? v_mul(v,r) : v_div(v,r,&S->err_pos,slash_pos);
+        if(S->err_pos){ S->div_zero = 1; return make_int(0); }   // only v_div can fail here
     }
     return v;
 }
@@ -217,23 +555,33 @@ static Value parse_term(Scanner *S){
 // Power: handles exponentiation (right-associative)
 static Value parse_power(Scanner *S){
     Value left = parse_unary(S);
-    if(S->cur.type==T_POW){ advance(S); Value right = parse_power(S); left = v_pow(left,right); }
+    if(S->cur.type==T_POW){
+        if(++S->depth > CALC_MAX_DEPTH){ set_error(S, S->cur.start_pos); return make_int(0); }
+        advance(S); Value right = parse_power(S); S->depth--;
+        left = g_prof_on ? prof_op(OP_POW, left, right, NULL, 0) : v_pow(left,right);
+    }
     return left;
 }
 
-// Unary operators (+ and -)
+// Unary operators (+ and -): count the signs, then negate innermost-first
 static Value parse_unary(Scanner *S){
-    if(S->cur.type==T_PLUS){ advance(S); return parse_unary(S); }
-    if(S->cur.type==T_MINUS){ advance(S); Value v=parse_unary(S); return v.is_float? make_double(-v.d) : make_int(-v.i); }
-    return parse_primary(S);
+    size_t neg = 0;
+    while(S->cur.type==T_PLUS || S->cur.type==T_MINUS){ if(S->cur.type==T_MINUS) neg++; advance(S); }
+    Value v = parse_primary(S);
+    while(neg--){
+        if(g_prof_on) v = prof_op(OP_NEG, v, v, NULL, 0);
+        else v = v.is_float? make_double(-v.d) : make_int(-v.i);
+    }
+    return v;
 }
 
 // Primary: number or parenthesized expression
 static Value parse_primary(Scanner *S){
     if(S->cur.type==T_NUM){ Value v=S->cur.is_float? make_double(S->cur.d) : make_int(S->cur.i); advance(S); return v; }
     if(S->cur.type==T_LPAREN){
+        if(++S->depth > CALC_MAX_DEPTH){ set_error(S, S->cur.start_pos); return make_int(0); }
         advance(S);
-        Value inside = parse_expr(S);
+        Value inside = parse_expr(S); S->depth--;
         if(S->err_pos) return make_int(0);
         if(S->cur.type!=T_RPAREN){ if(S->cur.type==T_EOF) set_error(S, S->pos); else set_error(S, S->cur.start_pos); return make_int(0); }
         advance(S); return inside;
@@ -244,47 +592,896 @@ static Value parse_primary(Scanner *S){
 
 // ============================== Evaluation API ==============================
 // Evaluates a full expression from a memory buffer
-typedef struct { int ok; Value v; size_t err_pos; } EvalResult;
+typedef struct { int ok; Value v; size_t err_pos; int div_zero; unsigned long long ntokens; } EvalResult;
 
 static EvalResult eval_buffer(const char *buf, size_t len){
     Scanner S; memset(&S,0,sizeof S);
     S.src=buf; S.len=len; S.pos=1; S.idx0=0; S.err_pos=0;
     advance(&S);
     Value v = parse_expr(&S);
-    if(S.err_pos){ EvalResult r={0,make_int(0),S.err_pos}; return r; }
-    if(S.cur.type != T_EOF){ set_error(&S, S.cur.start_pos); EvalResult r={0,make_int(0),S.err_pos}; return r; }
-    EvalResult r={1,v,0}; return r;
+    if(S.err_pos){ EvalResult r={0,make_int(0),S.err_pos,S.div_zero,S.ntokens}; return r; }
+    if(S.cur.type != T_EOF){ set_error(&S, S.cur.start_pos); EvalResult r={0,make_int(0),S.err_pos,0,S.ntokens}; return r; }
+    EvalResult r={1,v,0,0,S.ntokens}; return r;
 }
 
 // =============================== Printing ===================================
-// Prints a Value to file; prints as int if the float is integral
+// Formats a Value into buf; prints as int if the float is integral.
+// Returns the number of bytes written (snprintf semantics).
 static int is_integral_double(double x){ double r = llround(x); return fabs(x - r) < 1e-12; }
-static void print_value(FILE *out, Value v){
-    if(!v.is_float) fprintf(out, "%lld\n", v.i);
-    else if(is_integral_double(v.d)) fprintf(out, "%lld\n", (long long)llround(v.d));
-    else fprintf(out, "%.15g\n", v.d);
+static int print_value(char *buf, size_t bufsz, Value v){
+    if(!v.is_float) return snprintf(buf, bufsz, "%lld\n", v.i);
+    if(is_integral_double(v.d)) return snprintf(buf, bufsz, "%lld\n", (long long)llround(v.d));
+    return snprintf(buf, bufsz, "%.15g\n", v.d);
+}
+// Formats a whole evaluation result: the value or `ERROR:<pos>`
+static int format_result(char *buf, size_t bufsz, EvalResult R){
+    if(R.ok) return print_value(buf, bufsz, R.v);
+    return snprintf(buf, bufsz, "ERROR:%zu\n", R.err_pos);
+}
+
+// ============================ Allocation check ==============================
+// eval_buffer and format_result never touch the heap: the scanner, the parse
+// recursion and the result live on the caller's stack and text goes into the
+// caller's buffer, so evaluation never meets the allocator (or its locks) on
+// any thread. Built with -DCALC_ALLOC_CHECK, calc interposes malloc, calloc,
+// realloc and free with a per-thread call counter, and --check-noalloc runs a
+// warm-up round of sample expressions and then fails if any later round
+// makes a heap call.
+#ifdef CALC_ALLOC_CHECK
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void*, size_t);
+extern void  __libc_free(void*);
+static _Thread_local unsigned long t_heap_calls;
+void *malloc(size_t n){ t_heap_calls++; return __libc_malloc(n); }
+void *calloc(size_t k, size_t n){ t_heap_calls++; return __libc_calloc(k, n); }
+void *realloc(void *p, size_t n){ t_heap_calls++; return __libc_realloc(p, n); }
+void  free(void *p){ if(p) t_heap_calls++; __libc_free(p); }
+
+// Covers every operator, int/float promotion, pow, errors and comments
+static const char *const noalloc_cases[] = {
+    "1+2*3", "2**3**2", "-(-(+4))", "7/2", "1/0", "1.5e3*2.25", "0.1+0.2", "2**0.5",
+    "2**-1", "(1+2", "3 4", "", "# comment\n  3 - 4\n", "((((((((((1))))))))))",
+    "12345678901234567890", "1e308*10", "-9223372036854775807-1", "1.0/3*3",
+};
+
+static int check_noalloc(int rounds){
+    const size_t ncases = sizeof noalloc_cases / sizeof *noalloc_cases;
+    char res[64]; size_t sink = 0;
+    unsigned long before = 0;
+    for(int r=0;r<=rounds;r++){
+        if(r==1) before = t_heap_calls;   // round 0 warms up (lazy libc/libm state)
+        for(size_t i=0;i<ncases;i++){
+            EvalResult R = eval_buffer(noalloc_cases[i], strlen(noalloc_cases[i]));
+            sink += (size_t)format_result(res, sizeof res, R);
+        }
+    }
+    unsigned long calls = t_heap_calls - before;
+    printf("no-alloc check: %lu heap calls in %zu evaluations (%zu bytes formatted): %s\n",
+           calls, (size_t)rounds * ncases, sink, calls ? "FAIL" : "ok");
+    return calls ? 1 : 0;
+}
+#else
+static int check_noalloc(int rounds){
+    (void)rounds;
+    fprintf(stderr,"--check-noalloc not supported (build with -DCALC_ALLOC_CHECK)\n");
+    return 1;
+}
+#endif
+
+// ================================ Aggregates ================================
+// --aggregate sum,min,max,mean,count,errors: results are folded as they are
+// produced and only the summary is printed. Integer results are summed
+// exactly in 128 bits; float results use Neumaier (compensated) summation.
+// All state is plain counters and sums, so partial aggregates can later be
+// merged in a fixed order with identical output.
+typedef enum { AGG_SUM, AGG_MIN, AGG_MAX, AGG_MEAN, AGG_COUNT, AGG_ERRORS, AGG_NKINDS } AggKind;
+static const char *const agg_names[AGG_NKINDS] = { "sum", "min", "max", "mean", "count", "errors" };
+
+typedef struct {
+    AggKind want[AGG_NKINDS]; int nwant;    // requested fields, in order
+    unsigned long long count, errors;       // count = successful results
+    __int128 isum;                          // exact sum of integer results
+    double fsum, fcomp;                     // compensated sum of float results
+    int any_float;                          // a float result was folded in
+    int have_minmax; Value min, max;
+} Agg;
+
+// Parses "sum,min,..." into a->want; returns -1 on an unknown name
+static int agg_parse(Agg *a, const char *spec){
+    memset(a, 0, sizeof *a);
+    while(*spec){
+        size_t n = strcspn(spec, ",");
+        int k = 0;
+        while(k<AGG_NKINDS && !(strlen(agg_names[k])==n && strncmp(spec, agg_names[k], n)==0)) k++;
+        if(k==AGG_NKINDS || a->nwant==AGG_NKINDS) return -1;
+        a->want[a->nwant++] = (AggKind)k;
+        spec += n; if(*spec==',') spec++;
+    }
+    return a->nwant ? 0 : -1;
+}
+
+static double value_as_double(Value v){ return v.is_float ? v.d : (double)v.i; }
+static int value_less(Value a, Value b){
+    if(!a.is_float && !b.is_float) return a.i < b.i;
+    return value_as_double(a) < value_as_double(b);
+}
+
+static void neumaier_add(double *sum, double *comp, double x){
+    double t = *sum + x;
+    if(fabs(*sum) >= fabs(x)) *comp += (*sum - t) + x;
+    else *comp += (x - t) + *sum;
+    *sum = t;
+}
+
+static void agg_add(Agg *a, EvalResult R){
+    if(!R.ok){ a->errors++; return; }
+    a->count++;
+    if(R.v.is_float){ neumaier_add(&a->fsum, &a->fcomp, R.v.d); a->any_float = 1; }
+    else a->isum += R.v.i;
+    if(!a->have_minmax){ a->min = a->max = R.v; a->have_minmax = 1; }
+    else{
+        if(value_less(R.v, a->min)) a->min = R.v;
+        if(value_less(a->max, R.v)) a->max = R.v;
+    }
+}
+
+static void print_int128(FILE *f, __int128 x){
+    char tmp[48]; int n = 0;
+    unsigned __int128 u = x < 0 ? -(unsigned __int128)x : (unsigned __int128)x;
+    do{ tmp[n++] = (char)('0' + (int)(u % 10)); u /= 10; } while(u);
+    if(x < 0) fputc('-', f);
+    while(n) fputc(tmp[--n], f);
+    fputc('\n', f);
+}
+
+// Integer sum plus compensated float sum. isum is split into 42-bit pieces,
+// each exact as a double, and fed through the same compensated sum, so bits
+// above 2^53 are not rounded away before the floats are added.
+static double agg_total(const Agg *a){
+    double s = 0, c = 0;
+    __int128 hi = a->isum >> 84;
+    long long mid = (long long)((a->isum >> 42) & (((__int128)1 << 42) - 1));
+    long long lo = (long long)(a->isum & (((__int128)1 << 42) - 1));
+    neumaier_add(&s, &c, ldexp((double)hi, 84));
+    neumaier_add(&s, &c, ldexp((double)mid, 42));
+    neumaier_add(&s, &c, (double)lo);
+    neumaier_add(&s, &c, a->fsum);
+    neumaier_add(&s, &c, a->fcomp);
+    return s + c;
+}
+
+static void agg_print(FILE *f, const Agg *a){
+    char num[64];
+    int all_int = !a->any_float;
+    double total = agg_total(a);
+    for(int k=0;k<a->nwant;k++){
+        fprintf(f, "%s\t", agg_names[a->want[k]]);
+        switch(a->want[k]){
+            case AGG_SUM:
+                if(all_int) print_int128(f, a->isum);
+                else { print_value(num, sizeof num, make_double(total)); fputs(num, f); }
+                break;
+            case AGG_MIN: case AGG_MAX:
+                if(!a->have_minmax) fputs("-\n", f);
+                else { print_value(num, sizeof num, a->want[k]==AGG_MIN ? a->min : a->max); fputs(num, f); }
+                break;
+            case AGG_MEAN:
+                if(!a->count) fputs("-\n", f);
+                else { print_value(num, sizeof num, make_double(total / (double)a->count)); fputs(num, f); }
+                break;
+            case AGG_COUNT:  fprintf(f, "%llu\n", a->count); break;
+            case AGG_ERRORS: fprintf(f, "%llu\n", a->errors); break;
+            default: break;
+        }
+    }
+}
+
+// ============================ Hardware counters =============================
+// --perf-counters: cycles, instructions, branch misses and cache misses from
+// perf_event_open, read as one group at every --stats phase boundary and
+// charged to the same phases (lex+parse/eval = eval_buffer: next_token and
+// scan_number interleaved with the parse_* chain and the v_* arithmetic). Counters the kernel or the
+// container refuses are reported as unavailable; the run itself goes on.
+enum { HW_CYCLES, HW_INSTR, HW_BRMISS, HW_CACHEMISS, HW_N };
+static const char *const hw_names[HW_N] = { "cycles", "instructions", "branch-misses", "cache-misses" };
+
+typedef struct {
+    int on;                 // at least one counter is counting
+    int leader;             // group leader fd
+    int slot[HW_N];         // position in the group read, or -1
+    int nopen;
+} HwCounters;
+
+static HwCounters g_hw = { 0, -1, { -1, -1, -1, -1 }, 0 };
+
+// Opens the counter group; returns 0 if anything could be opened
+static int hw_open(void){
+#ifdef __linux__
+    static const unsigned long long cfg[HW_N] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES };
+    int err = 0;
+    for(int k=0;k<HW_N;k++){
+        struct perf_event_attr a; memset(&a, 0, sizeof a);
+        a.size = sizeof a; a.type = PERF_TYPE_HARDWARE; a.config = cfg[k];
+        a.disabled = (g_hw.leader < 0); a.exclude_kernel = 1; a.exclude_hv = 1;
+        a.read_format = PERF_FORMAT_GROUP;
+        int fd = (int)syscall(SYS_perf_event_open, &a, 0, -1, g_hw.leader, PERF_FLAG_FD_CLOEXEC);
+        if(fd < 0){ err = errno; continue; }
+        if(g_hw.leader < 0) g_hw.leader = fd;
+        g_hw.slot[k] = g_hw.nopen++;
+    }
+    if(g_hw.leader < 0){
+        fprintf(stderr, "perf counters unavailable: %s\n", strerror(err));
+        return -1;
+    }
+    if(err) fprintf(stderr, "some perf counters unavailable: %s\n", strerror(err));
+    ioctl(g_hw.leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(g_hw.leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    g_hw.on = 1;
+    return 0;
+#else
+    fprintf(stderr, "perf counters unavailable on this platform\n");
+    return -1;
+#endif
+}
+
+// One read() for the whole group; counters that are not open read as 0
+static void hw_read(unsigned long long out[HW_N]){
+    unsigned long long buf[1 + HW_N];
+    memset(out, 0, HW_N * sizeof *out);
+    if(read(g_hw.leader, buf, sizeof buf) < (ssize_t)sizeof(unsigned long long)) return;
+    for(int k=0;k<HW_N;k++) if(g_hw.slot[k] >= 0 && (unsigned long long)g_hw.slot[k] < buf[0]) out[k] = buf[1 + g_hw.slot[k]];
+}
+
+// ================================== Memory ==================================
+// Heap buffers go through mem_alloc/mem_realloc/mem_free, tagged with the call
+// site they belong to. Normally that is plain malloc/realloc/free behind one
+// branch; with --mem-stats each site also counts allocations and bytes
+// (malloc_usable_size, so a buffer is charged the same on alloc and on free;
+// --mem-stats is refused where the C library has no such call)
+// and peak live bytes, and at exit calc reports peak RSS and any buffers that
+// were never freed. Counters are relaxed atomics, safe from any thread.
+typedef enum { MEM_INPUT, MEM_OUTPUT, MEM_NDJSON, MEM_INSTR, MEM_SITES } MemSite;
+static const char *const mem_site_names[MEM_SITES] = { "input", "output", "ndjson", "instrumentation" };
+
+typedef struct { atomic_ullong allocs, frees, bytes, live, peak; } MemCount;
+
+static int g_mem_on;
+static MemCount g_mem[MEM_SITES];
+static atomic_ullong g_mem_live, g_mem_peak;
+
+static void mem_raise(atomic_ullong *peak, unsigned long long v){
+    unsigned long long p = atomic_load_explicit(peak, memory_order_relaxed);
+    while(v > p && !atomic_compare_exchange_weak_explicit(peak, &p, v, memory_order_relaxed, memory_order_relaxed)) {}
+}
+static void mem_charge(MemSite s, unsigned long long n){
+    MemCount *c = &g_mem[s];
+    atomic_fetch_add_explicit(&c->allocs, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&c->bytes, n, memory_order_relaxed);
+    mem_raise(&c->peak, atomic_fetch_add_explicit(&c->live, n, memory_order_relaxed) + n);
+    mem_raise(&g_mem_peak, atomic_fetch_add_explicit(&g_mem_live, n, memory_order_relaxed) + n);
+}
+static void mem_credit(MemSite s, unsigned long long n){
+    MemCount *c = &g_mem[s];
+    atomic_fetch_add_explicit(&c->frees, 1, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&c->live, n, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&g_mem_live, n, memory_order_relaxed);
+}
+
+#ifdef CALC_MEM_SIZE
+static size_t mem_size(void *p){ return CALC_MEM_SIZE(p); }
+#else
+static size_t mem_size(void *p){ (void)p; return 0; }
+#endif
+
+static void *mem_alloc(MemSite s, size_t n){
+    void *p = malloc(n);
+    if(g_mem_on && p) mem_charge(s, mem_size(p));
+    return p;
+}
+// A move counts as one free plus one allocation
+static void *mem_realloc(MemSite s, void *p, size_t n){
+    if(!g_mem_on) return realloc(p, n);
+    size_t old = p ? mem_size(p) : 0;
+    void *q = realloc(p, n);
+    if(!q) return NULL;
+    if(p) mem_credit(s, old);
+    mem_charge(s, mem_size(q));
+    return q;
+}
+static void mem_free(MemSite s, void *p){
+    if(g_mem_on && p) mem_credit(s, mem_size(p));
+    free(p);
+}
+
+// Prints the --mem-stats report; returns -1 if a tracked buffer was never freed
+static int mem_print(FILE *f){
+    struct rusage ru; memset(&ru, 0, sizeof ru);
+    getrusage(RUSAGE_SELF, &ru);
+    fprintf(f, "memory: peak RSS %.1f MB, peak heap (tracked) %.1f MB\n",
+            ru.ru_maxrss / 1024.0, atomic_load(&g_mem_peak) / 1048576.0);
+    fprintf(f, "%-16s %12s %12s %16s %14s %14s\n", "site", "allocs", "frees", "bytes", "peak live", "live at exit");
+    int leaked = 0;
+    for(int s=0;s<MEM_SITES;s++){
+        MemCount *c = &g_mem[s];
+        unsigned long long a = atomic_load(&c->allocs), fr = atomic_load(&c->frees), live = atomic_load(&c->live);
+        if(!a) continue;
+        fprintf(f, "%-16s %12llu %12llu %16llu %14llu %14llu\n", mem_site_names[s], a, fr,
+                (unsigned long long)atomic_load(&c->bytes), (unsigned long long)atomic_load(&c->peak), live);
+        if(a != fr){ leaked = 1; fprintf(stderr, "never freed: %llu %s buffer(s), %llu bytes\n", a - fr, mem_site_names[s], live); }
+    }
+    return leaked ? -1 : 0;
+}
+
+// ================================== Trace ===================================
+// --trace FILE: spans per input file and per stage (the --stats phases), kept
+// in per-thread buffers that only their owner thread appends to; a buffer is
+// linked into a global list with one CAS when its thread first records. At
+// exit the buffers are written in Chrome trace-event format, one track per
+// thread, for chrome://tracing or ui.perfetto.dev.
+// Appends n bytes to a growable buffer
+static int buf_append(MemSite site, char **b, size_t *len, size_t *cap, const void *p, size_t n){
+    if(*len + n > *cap){
+        size_t nc = *cap ? *cap : 4096;
+        while(nc < *len + n) nc *= 2;
+        char *nb = (char*)mem_realloc(site, *b, nc);
+        if(!nb) return -1;
+        *b = nb; *cap = nc;
+    }
+    memcpy(*b + *len, p, n); *len += n;
+    return 0;
+}
+
+typedef struct { const char *name; size_t arg; double ts, dur; } TraceEv;   // arg: 1 + offset in strs, 0 = none
+
+typedef struct TraceBuf {
+    TraceEv *ev; size_t n, cap;
+    char *strs; size_t slen, scap;   // copied span arguments (file names)
+    int tid;
+    size_t dropped;                  // events lost to allocation failure
+    struct TraceBuf *next;
+} TraceBuf;
+
+static int g_trace_on;
+static int g_trace_stages = 1;              // 0: no per-stage spans (--ndjson)
+static double g_trace_t0;                   // CLOCK_MONOTONIC seconds at start
+static _Atomic(TraceBuf*) g_trace_list;
+static atomic_int g_trace_ntids;
+static _Thread_local TraceBuf *t_trace;
+
+static double mono_now(void){
+    struct timespec w; clock_gettime(CLOCK_MONOTONIC, &w);
+    return w.tv_sec + w.tv_nsec*1e-9;
+}
+
+static TraceBuf *trace_buf(void){
+    if(t_trace) return t_trace;
+    TraceBuf *b = (TraceBuf*)mem_alloc(MEM_INSTR, sizeof *b);
+    if(!b) return NULL;
+    memset(b, 0, sizeof *b);
+    b->tid = atomic_fetch_add(&g_trace_ntids, 1);
+    b->next = atomic_load(&g_trace_list);
+    while(!atomic_compare_exchange_weak(&g_trace_list, &b->next, b)) {}
+    return t_trace = b;
+}
+
+// Records a complete span [t0, t1] (seconds, CLOCK_MONOTONIC)
+static void trace_span(const char *name, double t0, double t1, const char *arg){
+    TraceBuf *b = trace_buf();
+    if(!b) return;
+    if(b->n == b->cap){
+        size_t nc = b->cap ? b->cap*2 : 1024;
+        TraceEv *ne = (TraceEv*)mem_realloc(MEM_INSTR, b->ev, nc * sizeof *ne);
+        if(!ne){ b->dropped++; return; }
+        b->ev = ne; b->cap = nc;
+    }
+    size_t off = 0;
+    if(arg){
+        size_t n = strlen(arg) + 1;
+        if(buf_append(MEM_INSTR, &b->strs, &b->slen, &b->scap, arg, n)){ b->dropped++; return; }
+        off = b->slen - n + 1;
+    }
+    TraceEv *e = &b->ev[b->n++];
+    e->name = name; e->arg = off;
+    e->ts = (t0 - g_trace_t0) * 1e6; e->dur = (t1 - t0) * 1e6;
+}
+
+static void json_put_string(FILE *f, const char *s){
+    fputc('"', f);
+    for(; *s; s++){
+        unsigned char c = (unsigned char)*s;
+        if(c=='"' || c=='\\') fprintf(f, "\\%c", c);
+        else if(c < 0x20) fprintf(f, "\\u%04x", c);
+        else fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+// Writes the trace and releases the buffers
+static int trace_write(const char *path){
+    FILE *f = fopen(path, "w");
+    if(!f){ fprintf(stderr,"write fail: %s\n", path); return -1; }
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", f);
+    int first = 1;
+    size_t dropped = 0;
+    for(TraceBuf *b = atomic_load(&g_trace_list); b; b = b->next){
+        fprintf(f, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", first ? "" : ",\n", b->tid);
+        if(b->tid==0) fputs("\"main\"", f); else fprintf(f, "\"worker %d\"", b->tid);
+        fputs("}}", f);
+        first = 0;
+        for(size_t i=0;i<b->n;i++){
+            const TraceEv *e = &b->ev[i];
+            fprintf(f, ",\n{\"ph\":\"X\",\"name\":\"%s\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f", e->name, b->tid, e->ts, e->dur);
+            if(e->arg){ fputs(",\"args\":{\"file\":", f); json_put_string(f, b->strs + e->arg - 1); fputc('}', f); }
+            fputc('}', f);
+        }
+        dropped += b->dropped;
+    }
+    for(TraceBuf *b = atomic_exchange(&g_trace_list, NULL), *next; b; b = next){
+        next = b->next;
+        mem_free(MEM_INSTR, b->ev); mem_free(MEM_INSTR, b->strs); mem_free(MEM_INSTR, b);
+    }
+    t_trace = NULL;
+    fputs("\n]}\n", f);
+    if(dropped) fprintf(stderr, "trace: %zu events dropped (out of memory)\n", dropped);
+    if(fclose(f)!=0){ fprintf(stderr,"write fail: %s\n", path); return -1; }
+    return 0;
+}
+
+// ================================= Slow log =================================
+// --slow-log FILE [--slow-threshold T]: eval_counted times every eval_buffer
+// call (the clock reads it already takes) and passes anything slower than T
+// to slow_log. Only then is the input re-lexed for its token count and paren
+// depth, and one tab-separated line is appended to FILE (a single fprintf,
+// so lines from different threads do not interleave). Callers say which
+// input is being evaluated with slow_source before they evaluate it.
+typedef struct { const char *where; char sep; const char *name; size_t line; } SlowSrc;
+
+static int g_slow_on;
+static double g_slow_threshold = 0.005;   // seconds
+static FILE *g_slow_f;
+static atomic_ullong g_slow_count;
+static _Thread_local SlowSrc t_slow_src;
+
+static void slow_source(const char *where, char sep, const char *name, size_t line){
+    SlowSrc s = { where, sep, name, line };
+    t_slow_src = s;
+}
+
+// Parses "5ms", "200us", "1.5s", "800ns" (a bare number is ms) into seconds
+static int parse_duration(const char *s, double *out){
+    char *end; double v = strtod(s, &end);
+    if(end==s || v < 0) return -1;
+    if(*end=='\0' || strcmp(end,"ms")==0) v /= 1e3;
+    else if(strcmp(end,"us")==0) v /= 1e6;
+    else if(strcmp(end,"ns")==0) v /= 1e9;
+    else if(strcmp(end,"s")!=0) return -1;
+    *out = v; return 0;
+}
+
+static int slow_open(const char *path){
+    g_slow_f = fopen(path, "w");
+    if(!g_slow_f){ fprintf(stderr,"write fail: %s\n", path); return -1; }
+    fputs("# time_ms\tpath\tline\tbytes\ttokens\tdepth\n", g_slow_f);
+    g_slow_on = 1;
+    return 0;
+}
+
+static void slow_log(const char *buf, size_t len, double secs){
+    Scanner S; memset(&S,0,sizeof S);
+    S.src=buf; S.len=len; S.pos=1;
+    unsigned long long tokens = 0; long depth = 0, max_depth = 0;
+    for(TokType t; (t = next_token(&S).type) != T_EOF; tokens++){
+        if(t==T_LPAREN && ++depth > max_depth) max_depth = depth;
+        else if(t==T_RPAREN && depth > 0) depth--;
+    }
+    const SlowSrc *s = &t_slow_src;
+    char where[1024] = "";
+    if(s->where) snprintf(where, sizeof where, "%s%c", s->where, s->sep);
+    fprintf(g_slow_f, "%.3f\t%s%s\t%zu\t%zu\t%llu\t%ld\n", secs*1e3, where, s->name ? s->name : "?", s->line, len, tokens, max_depth);
+    atomic_fetch_add_explicit(&g_slow_count, 1, memory_order_relaxed);
+}
+
+static int slow_close(const char *path){
+    int rc = (ferror(g_slow_f) | fclose(g_slow_f)) ? -1 : 0;
+    if(rc) fprintf(stderr,"write fail: %s\n", path);
+    fprintf(stderr, "slow log: %llu inputs over %.3f ms -> %s\n", (unsigned long long)atomic_load(&g_slow_count), g_slow_threshold*1e3, path);
+    return rc;
+}
+
+// ================================== Stats ===================================
+// --stats[=json]: wall and CPU time per phase plus run counters, printed to
+// stderr at exit. Everything sits behind g_instr (stats or trace on), so a
+// normal run pays one predictable branch per phase. The parser pulls tokens
+// on demand, so lexing and parsing are one phase: eval_buffer exactly as an
+// uninstrumented run executes it, with no clock reads per token. The token
+// count comes from the scanner itself (EvalResult.ntokens).
+typedef enum { PH_READ, PH_EVAL, PH_FORMAT, PH_OUTPUT, PH_N } Phase;
+static const char *const phase_names[PH_N] = { "read", "lex+parse/eval", "format", "output" };
+
+typedef struct { double wall, cpu; unsigned long long hw[HW_N]; } Stamp;   // seconds, raw counts
+
+typedef struct {
+    double wall[PH_N], cpu[PH_N];
+    unsigned long long hw[PH_N][HW_N];
+    unsigned long long files, bytes, tokens, exprs, errors, div_zero;
+    Stamp start;
+} Stats;
+
+static int   g_stats_on;     // 0 = off, 1 = text, 2 = json
+static int   g_instr;        // any per-phase instrumentation (stats, trace, latency, slow log)
+static Stats g_stats;
+
+static Stamp stamp_now(void){
+    Stamp s = { mono_now(), 0, {0} };
+    if(g_stats_on){
+        struct timespec c;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &c);
+        s.cpu = c.tv_sec + c.tv_nsec*1e-9;
+    }
+    if(g_hw.on) hw_read(s.hw);
+    return s;
+}
+
+// Ends phase p: charges the time since *since to it (and/or records a trace
+// span) and restarts the stopwatch
+static void mark_phase(Phase p, Stamp *since){
+    Stamp now = stamp_now();
+    if(g_stats_on){
+        g_stats.wall[p] += now.wall - since->wall;
+        g_stats.cpu[p]  += now.cpu  - since->cpu;
+        for(int k=0;k<HW_N;k++) g_stats.hw[p][k] += now.hw[k] - since->hw[k];
+    }
+    if(g_trace_on && g_trace_stages) trace_span(phase_names[p], since->wall, now.wall, NULL);
+    *since = now;
+}
+
+// eval_buffer plus the --stats bookkeeping for one expression
+static EvalResult eval_counted(const char *buf, size_t len){
+    if(!g_instr) return eval_buffer(buf, len);
+    Stamp t = stamp_now();
+    double eval_t0 = t.wall;
+    EvalResult R = eval_buffer(buf, len);
+    mark_phase(PH_EVAL, &t);
+    if(g_slow_on && t.wall - eval_t0 >= g_slow_threshold) slow_log(buf, len, t.wall - eval_t0);
+    if(!g_stats_on) return R;
+    g_stats.exprs++; g_stats.bytes += len; g_stats.tokens += R.ntokens;
+    if(!R.ok){ g_stats.errors++; if(R.div_zero) g_stats.div_zero++; }
+    return R;
+}
+
+static void stats_print(FILE *f){
+    Stamp end = stamp_now();
+    double wall = end.wall - g_stats.start.wall, cpu = end.cpu - g_stats.start.cpu;
+    double other_w = wall, other_c = cpu;
+    for(int p=0;p<PH_N;p++){ other_w -= g_stats.wall[p]; other_c -= g_stats.cpu[p]; }
+    double mbs = wall>0 ? g_stats.bytes / 1e6 / wall : 0, eps = wall>0 ? g_stats.exprs / wall : 0;
+    const Stats *s = &g_stats;
+    if(g_stats_on==2){
+        fprintf(f, "{\"files\":%llu,\"bytes\":%llu,\"tokens\":%llu,\"expressions\":%llu,"
+                   "\"errors\":%llu,\"div_by_zero\":%llu,\"phases\":{",
+                s->files, s->bytes, s->tokens, s->exprs, s->errors, s->div_zero);
+        for(int p=0;p<PH_N;p++)
+            fprintf(f, "\"%s\":{\"wall_ms\":%.3f,\"cpu_ms\":%.3f},", phase_names[p], s->wall[p]*1e3, s->cpu[p]*1e3);
+        fprintf(f, "\"other\":{\"wall_ms\":%.3f,\"cpu_ms\":%.3f}},\"total\":{\"wall_ms\":%.3f,\"cpu_ms\":%.3f},"
+                   "\"mb_per_s\":%.3f,\"expr_per_s\":%.1f",
+                other_w*1e3, other_c*1e3, wall*1e3, cpu*1e3, mbs, eps);
+        if(g_hw.on){
+            fputs(",\"counters\":{", f);
+            for(int p=0;p<=PH_N;p++){
+                fprintf(f, "%s\"%s\":{", p ? "," : "", p<PH_N ? phase_names[p] : "total");
+                for(int k=0;k<HW_N;k++){
+                    unsigned long long v = p<PH_N ? s->hw[p][k] : end.hw[k] - s->start.hw[k];
+                    if(g_hw.slot[k] < 0) fprintf(f, "%s\"%s\":null", k ? "," : "", hw_names[k]);
+                    else fprintf(f, "%s\"%s\":%llu", k ? "," : "", hw_names[k], v);
+                }
+                fputc('}', f);
+            }
+            fputc('}', f);
+        }
+        fputs("}\n", f);
+        return;
+    }
+    fprintf(f, "files %llu, bytes %llu, tokens %llu, expressions %llu, errors %llu (division by zero %llu)\n",
+            s->files, s->bytes, s->tokens, s->exprs, s->errors, s->div_zero);
+    fprintf(f, "%-15s %12s %12s\n", "phase", "wall ms", "cpu ms");
+    for(int p=0;p<PH_N;p++) fprintf(f, "%-15s %12.3f %12.3f\n", phase_names[p], s->wall[p]*1e3, s->cpu[p]*1e3);
+    fprintf(f, "%-15s %12.3f %12.3f\n", "other", other_w*1e3, other_c*1e3);
+    fprintf(f, "%-15s %12.3f %12.3f\n", "total", wall*1e3, cpu*1e3);
+    fprintf(f, "throughput   %.3f MB/s, %.1f expr/s\n", mbs, eps);
+    if(!g_hw.on) return;
+    fprintf(f, "%-15s", "phase");
+    for(int k=0;k<HW_N;k++) fprintf(f, " %14s", hw_names[k]);
+    fprintf(f, " %6s\n", "IPC");
+    for(int p=0;p<=PH_N;p++){
+        const unsigned long long *v = p<PH_N ? s->hw[p] : NULL;
+        unsigned long long tot[HW_N];
+        if(!v){ for(int k=0;k<HW_N;k++) tot[k] = end.hw[k] - s->start.hw[k]; v = tot; }
+        fprintf(f, "%-15s", p<PH_N ? phase_names[p] : "total");
+        for(int k=0;k<HW_N;k++){
+            if(g_hw.slot[k] < 0) fprintf(f, " %14s", "n/a");
+            else fprintf(f, " %14llu", v[k]);
+        }
+        if(g_hw.slot[HW_CYCLES] >= 0 && g_hw.slot[HW_INSTR] >= 0 && v[HW_CYCLES]) fprintf(f, " %6.2f\n", (double)v[HW_INSTR] / (double)v[HW_CYCLES]);
+        else fprintf(f, " %6s\n", "n/a");
+    }
+}
+
+// ================================= Latency ==================================
+// --latency: time per input file and per --ndjson record, kept in log-linear
+// (HDR-style) histograms: LAT_SUB linear sub-buckets per power of two of
+// nanoseconds, so a bucket is never wider than 1/LAT_SUB (~3%) of its value.
+// Each thread records into its own histogram, linked into a global list with
+// one CAS like the trace buffers; nothing is shared on the record path, and
+// the histograms are merged only at exit. The slowest LAT_WORST inputs of
+// each kind are kept with their path (and line for records).
+#define LAT_SUB_BITS 5
+#define LAT_SUB      (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS  ((64 - LAT_SUB_BITS + 1) * LAT_SUB)
+#define LAT_WORST    5
+
+typedef enum { LAT_FILE, LAT_EXPR, LAT_KINDS } LatKind;
+static const char *const lat_names[LAT_KINDS] = { "file", "expression" };
+
+// One of the LAT_WORST most expensive inputs (by latency, or by op time)
+typedef struct {
+    unsigned long long cost;
+    const char *where; char sep;   // containing dir/archive (lives for the run), or NULL
+    char name[256]; size_t line;   // line 0: whole file
+} Offender;
+
+// Inserts e into w[LAT_WORST], kept most expensive first
+static void offender_add(Offender *w, const Offender *e){
+    if(e->cost <= w[LAT_WORST-1].cost) return;
+    int i = LAT_WORST - 1;
+    for(; i>0 && w[i-1].cost < e->cost; i--) w[i] = w[i-1];
+    w[i] = *e;
+}
+static void offender_note(Offender *w, unsigned long long cost, const char *where, char sep, const char *name, size_t line){
+    if(cost <= w[LAT_WORST-1].cost) return;
+    Offender e = { cost, where, sep, "", line };
+    snprintf(e.name, sizeof e.name, "%s", name);
+    offender_add(w, &e);
+}
+static void offender_put(FILE *f, const Offender *w){
+    if(w->where) fprintf(f, "%s%c", w->where, w->sep);
+    if(w->line) fprintf(f, "%s:%zu\n", w->name, w->line);
+    else fprintf(f, "%s\n", w->name);
+}
+
+typedef struct LatHist {
+    unsigned long long count[LAT_KINDS][LAT_BUCKETS];
+    unsigned long long n[LAT_KINDS], max[LAT_KINDS];
+    double sum[LAT_KINDS];
+    Offender worst[LAT_KINDS][LAT_WORST];   // slowest first
+    struct LatHist *next;
+} LatHist;
+
+static int g_lat_on;
+static _Atomic(LatHist*) g_lat_list;
+static _Thread_local LatHist *t_lat;
+
+static unsigned lat_bucket(unsigned long long v){
+    if(v < LAT_SUB) return (unsigned)v;
+    unsigned shift = 63 - (unsigned)__builtin_clzll(v) - LAT_SUB_BITS;
+    return (shift + 1) * LAT_SUB + (unsigned)(v >> shift) - LAT_SUB;
+}
+// Highest value that falls into bucket i
+static unsigned long long lat_bucket_top(unsigned i){
+    if(i < LAT_SUB) return i;
+    unsigned shift = i / LAT_SUB - 1;
+    return ((unsigned long long)(LAT_SUB + i % LAT_SUB) << shift) + ((1ULL << shift) - 1);
+}
+
+static void lat_record(LatKind k, double t0, double t1, const char *where, char sep, const char *name, size_t line){
+    LatHist *h = t_lat;
+    if(!h){
+        if(!(h = (LatHist*)mem_alloc(MEM_INSTR, sizeof *h))) return;
+        memset(h, 0, sizeof *h);
+        h->next = atomic_load(&g_lat_list);
+        while(!atomic_compare_exchange_weak(&g_lat_list, &h->next, h)) {}
+        t_lat = h;
+    }
+    unsigned long long ns = t1 > t0 ? (unsigned long long)((t1 - t0) * 1e9) : 0;
+    h->count[k][lat_bucket(ns)]++;
+    h->n[k]++; h->sum[k] += (double)ns;
+    if(ns > h->max[k]) h->max[k] = ns;
+    offender_note(h->worst[k], ns, where, sep, name, line);
+}
+
+static const char *fmt_ns(char *buf, size_t n, double ns){
+    if(ns < 1e3) snprintf(buf, n, "%.0fns", ns);
+    else if(ns < 1e6) snprintf(buf, n, "%.1fus", ns/1e3);
+    else if(ns < 1e9) snprintf(buf, n, "%.2fms", ns/1e6);
+    else snprintf(buf, n, "%.2fs", ns/1e9);
+    return buf;
+}
+
+// Merges every thread's histogram into *out (call once the workers are done)
+static void lat_merge(LatHist *out){
+    memset(out, 0, sizeof *out);
+    for(const LatHist *h = atomic_load(&g_lat_list); h; h = h->next){
+        for(int k=0;k<LAT_KINDS;k++){
+            for(unsigned i=0;i<LAT_BUCKETS;i++) out->count[k][i] += h->count[k][i];
+            out->n[k] += h->n[k]; out->sum[k] += h->sum[k];
+            if(h->max[k] > out->max[k]) out->max[k] = h->max[k];
+            for(int j=0;j<LAT_WORST && h->worst[k][j].cost;j++) offender_add(out->worst[k], &h->worst[k][j]);
+        }
+    }
+}
+
+// Value at percentile p (0..100) of kind k, to bucket precision
+static unsigned long long lat_percentile(const LatHist *h, int k, double p){
+    unsigned long long target = (unsigned long long)ceil(p / 100.0 * (double)h->n[k]), seen = 0;
+    if(target == 0) target = 1;
+    for(unsigned i=0;i<LAT_BUCKETS;i++){
+        seen += h->count[k][i];
+        if(seen >= target){ unsigned long long v = lat_bucket_top(i); return v < h->max[k] ? v : h->max[k]; }
+    }
+    return h->max[k];
+}
+
+// Releases the per-thread histograms (at exit)
+static void lat_release(void){
+    for(LatHist *h = atomic_exchange(&g_lat_list, NULL), *next; h; h = next){ next = h->next; mem_free(MEM_INSTR, h); }
+    t_lat = NULL;
+}
+
+static void lat_print(FILE *f){
+    static LatHist m;   // ~30 KB: keep it off the stack
+    lat_merge(&m);
+    static const double pct[] = { 50, 90, 99, 99.9 };
+    for(int k=0;k<LAT_KINDS;k++){
+        if(!m.n[k]) continue;
+        char b[32];
+        fprintf(f, "latency per %s: n %llu, mean %s", lat_names[k], m.n[k], fmt_ns(b, sizeof b, m.sum[k] / (double)m.n[k]));
+        for(size_t j=0;j<sizeof pct/sizeof *pct;j++)
+            fprintf(f, ", p%g %s", pct[j], fmt_ns(b, sizeof b, (double)lat_percentile(&m, k, pct[j])));
+        fprintf(f, ", max %s\n", fmt_ns(b, sizeof b, (double)m.max[k]));
+        for(int j=0;j<LAT_WORST && m.worst[k][j].cost;j++){
+            fprintf(f, "  %10s  ", fmt_ns(b, sizeof b, (double)m.worst[k][j].cost));
+            offender_put(f, &m.worst[k][j]);
+        }
+    }
+}
+
+// ========================= Operation profile report =========================
+// Per-thread op counters (linked into a list like the latency histograms)
+// plus the LAT_WORST expressions with the most operation time. Ticks are
+// converted to ns with the tick rate measured over the run, after taking off
+// the cost of reading the counter itself (calibrated at start).
+typedef struct ProfThread {
+    OpCounts ops;
+    unsigned long long exprs;
+    Offender top[LAT_WORST];
+    struct ProfThread *next;
+} ProfThread;
+
+static _Atomic(ProfThread*) g_prof_list;
+static _Thread_local ProfThread *t_prof;
+static unsigned long long g_prof_tick0, g_prof_overhead;
+static double g_prof_wall0;
+
+static void prof_start(void){
+    unsigned long long best = ~0ULL;
+    for(int i=0;i<1000;i++){ unsigned long long a = op_ticks(), b = op_ticks(); if(b - a < best) best = b - a; }
+    g_prof_overhead = best;
+    g_prof_wall0 = mono_now(); g_prof_tick0 = op_ticks();
+}
+
+// Call before evaluating an input: resets the per-expression totals
+static void prof_expr_begin(void){
+    if(!t_prof){
+        ProfThread *p = (ProfThread*)mem_alloc(MEM_INSTR, sizeof *p);
+        if(!p) return;
+        memset(p, 0, sizeof *p);
+        p->next = atomic_load(&g_prof_list);
+        while(!atomic_compare_exchange_weak(&g_prof_list, &p->next, p)) {}
+        t_prof = p; t_ops = &p->ops;
+    }
+    t_ops->expr_ticks = t_ops->expr_ops = 0;
+}
+
+static void prof_expr_end(const char *where, char sep, const char *name, size_t line){
+    ProfThread *p = t_prof;
+    if(!p) return;
+    p->exprs++;
+    unsigned long long over = p->ops.expr_ops * g_prof_overhead;
+    if(p->ops.expr_ticks > over) offender_note(p->top, p->ops.expr_ticks - over, where, sep, name, line);
+}
+
+// Prints the merged profile and releases the per-thread counters
+static void prof_print(FILE *f){
+    double ns_per_tick = 1.0;
+    double wall = mono_now() - g_prof_wall0;
+    unsigned long long ticks = op_ticks() - g_prof_tick0;
+    if(ticks) ns_per_tick = wall * 1e9 / (double)ticks;
+    static OpCounts m;
+    Offender top[LAT_WORST]; memset(top, 0, sizeof top);
+    unsigned long long exprs = 0, ops = 0, total = 0;
+    memset(&m, 0, sizeof m);
+    for(ProfThread *p = atomic_exchange(&g_prof_list, NULL), *next; p; p = next){
+        next = p->next;
+        for(int k=0;k<OP_N;k++) for(int o=0;o<OPS_N;o++){ m.count[k][o] += p->ops.count[k][o]; m.ticks[k][o] += p->ops.ticks[k][o]; }
+        for(int j=0;j<LAT_WORST && p->top[j].cost;j++) offender_add(top, &p->top[j]);
+        exprs += p->exprs;
+        mem_free(MEM_INSTR, p);
+    }
+    t_prof = NULL; t_ops = NULL;
+    for(int k=0;k<OP_N;k++) for(int o=0;o<OPS_N;o++){
+        unsigned long long over = m.count[k][o] * g_prof_overhead;
+        m.ticks[k][o] = m.ticks[k][o] > over ? m.ticks[k][o] - over : 0;
+        ops += m.count[k][o]; total += m.ticks[k][o];
+    }
+    fprintf(f, "operation profile: %llu expressions, %llu operations, %.3f ms in operations\n",
+            exprs, ops, (double)total * ns_per_tick / 1e6);
+    fprintf(f, "%-5s %-8s %14s %12s %9s %7s\n", "op", "operands", "count", "total ms", "ns/op", "share");
+    for(int k=0;k<OP_N;k++) for(int o=0;o<OPS_N;o++){
+        unsigned long long n = m.count[k][o];
+        if(!n) continue;
+        double ns = (double)m.ticks[k][o] * ns_per_tick;
+        fprintf(f, "%-5s %-8s %14llu %12.3f %9.1f %6.1f%%\n", op_names[k], op_operand_names[o], n,
+                ns / 1e6, ns / (double)n, total ? 100.0 * (double)m.ticks[k][o] / (double)total : 0.0);
+    }
+    if(!top[0].cost) return;
+    fputs("top expressions by operation time:\n", f);
+    char b[32];
+    for(int j=0;j<LAT_WORST && top[j].cost;j++){
+        fprintf(f, "  %10s  ", fmt_ns(b, sizeof b, (double)top[j].cost * ns_per_tick));
+        offender_put(f, &top[j]);
+    }
 }
 
 // ================================ File I/O ==================================
 // Functions for reading and writing files, directory handling, etc.
-static int read_entire_file(const char *path, char **out_buf, size_t *out_len){
-    FILE *f = fopen(path, "rb");
-    if(!f) return -1;
-    if(fseek(f, 0, SEEK_END)!=0){ fclose(f); return -1; }
-    long l = ftell(f); if(l<0){ fclose(f); return -1; }
-    if(fseek(f, 0, SEEK_SET)!=0){ fclose(f); return -1; }
-    *out_buf = (char*)malloc((size_t)l + 1);
-    if(!*out_buf){ fclose(f); return -1; }
-    size_t rd = fread(*out_buf, 1, (size_t)l, f); (void)rd;
-    fclose(f);
-    (*out_buf)[l] = '\0'; *out_len = (size_t)l; return 0;
-}
-
-// Creates a directory if not exists
-static int ensure_dir(const char *path){
+// Directories are opened once and files are resolved relative to the fd with
+// openat(), so each per-file open is a single path-component lookup.
+typedef struct { const char *path; int fd; } DirRef;   // path is for messages only
+
+static int read_entire_file(int dirfd, const char *path, char **out_buf, size_t *out_len){
+    int fd = openat(dirfd, path, O_RDONLY|O_CLOEXEC);
+    if(fd<0) return -1;
     struct stat st;
-    if(stat(path,&st)==0){ if(S_ISDIR(st.st_mode)) return 0; errno=ENOTDIR; return -1; }
-    return mkdir(path, 0775);
+    if(fstat(fd,&st)!=0){ close(fd); return -1; }
+    size_t l = (size_t)st.st_size;
+    *out_buf = (char*)mem_alloc(MEM_INPUT, l + 1);
+    if(!*out_buf){ close(fd); return -1; }
+    size_t got = 0;
+    while(got < l){
+        ssize_t n = read(fd, *out_buf + got, l - got);
+        if(n<0){ if(errno==EINTR) continue; mem_free(MEM_INPUT, *out_buf); close(fd); return -1; }
+        if(n==0) break;   // file shrank under us
+        got += (size_t)n;
+    }
+    close(fd);
+    (*out_buf)[got] = '\0'; *out_len = got; return 0;
+}
+
+// Writes the whole buffer, retrying on short writes and EINTR
+static int write_all(int fd, const char *buf, size_t len){
+    while(len){
+        ssize_t n = write(fd, buf, len);
+        if(n<0){ if(errno==EINTR) continue; return -1; }
+        buf += n; len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Opens a directory, creating it first if it does not exist; returns the fd
+// or -1. The directory usually exists already, so try the open first.
+static int ensure_dir(const char *path){
+    int fd = open(path, O_RDONLY|O_DIRECTORY|O_CLOEXEC);   // ENOTDIR if it is a file
+    if(fd>=0 || errno!=ENOENT) return fd;
+    if(mkdir(path, 0775)!=0 && errno!=EEXIST) return -1;
+    return open(path, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+}
+
+// Prints "<msg>: <dir>/<name>" (or just <name> when there is no dir)
+static void report_path(const char *msg, const DirRef *d, const char *name){
+    if(d->path && *d->path) fprintf(stderr, "%s: %s/%s\n", msg, d->path, name);
+    else fprintf(stderr, "%s: %s\n", msg, name);
 }
 
 // Helper functions for path manipulation and naming
@@ -294,49 +1491,1546 @@ static void strip_ext(const char *fname, char *out, size_t outsz){
     snprintf(out, outsz, "%s", fname);
     char *dot = strrchr(out, '.'); if(dot) *dot = '\0';
 }
-static int ends_with_txt(const char *name){ size_t n=strlen(name); return (n>=4 && strcmp(name+n-4, ".txt")==0); }
+static int ends_with(const char *name, const char *suffix){ size_t n=strlen(name), k=strlen(suffix); return n>=k && strcmp(name+n-k, suffix)==0; }
+static int ends_with_txt(const char *name){ return ends_with(name, ".txt"); }
+// *.txt, or a compressed *.txt.gz / *.txt.zst (decoded by load_input)
+static int is_input_name(const char *name){ return ends_with_txt(name) || ends_with(name, ".txt.gz") || ends_with(name, ".txt.zst"); }
 static void build_default_outdir(const char *input_path, char *out, size_t outsz){
     char base[256]; strip_ext(base_name(input_path), base, sizeof base);
     snprintf(out, outsz, "%s_%s_%s", base, get_username(), STUDENT_ID);
 }
 static void build_output_filename(const char *input_path, char *out, size_t outsz){
     char base[256]; strip_ext(base_name(input_path), base, sizeof base);
+    if(ends_with(base, ".txt")) base[strlen(base)-4] = '\0';   // task1.txt.gz -> task1
     snprintf(out, outsz, "%s_%s_%s_%s.txt", base, STUDENT_NAME, STUDENT_LASTNAME, STUDENT_ID);
 }
 
+// ============================ Output durability =============================
+// How result files reach the disk (--durability):
+//   none    - written in place; a crash can leave a partial result file
+//   atomic  - written to an anonymous O_TMPFILE (or a ".<name>.<pid>.tmp" file
+//             when the filesystem lacks O_TMPFILE) and then linked/renamed into
+//             place, so a result file is always either old or complete
+//   durable - atomic, and the data is fsynced before publishing. Files are
+//             published in batches of DURABLE_BATCH: fsync all, rename all,
+//             then a single fsync of the output directory per batch.
+typedef enum { DUR_NONE=0, DUR_ATOMIC, DUR_DURABLE } Durability;
+#define DURABLE_BATCH 256
+
+typedef struct {
+    int  fd;            // open temp file
+    int  anon;          // 1 = O_TMPFILE (no name yet), 0 = named temp
+    char tmp[600];      // temp name (named temp, or staging for anon overwrite)
+    char name[512];     // final name
+} PendingOut;
+
+typedef struct {
+    DirRef dir;             // output directory
+    Durability dur;
+    int use_tmpfile;        // O_TMPFILE + linkat through /proc works here
+    PendingOut *pending;    // durable mode: files written but not yet published
+    size_t npending;
+    int if_changed;         // leave outputs alone when their content is identical
+    size_t written, skipped;
+    int binary;             // --format bin: results go to one CALCBIN_FILE
+    char *bin; size_t bin_len, bin_cap;         // header + records
+    char *names; size_t names_len, names_cap;   // name table
+    uint64_t bin_count;
+    Agg *agg;               // --aggregate: fold results instead of writing them
+} OutDir;
+
+static int parse_durability(const char *s, Durability *out){
+    if(strcmp(s,"none")==0)    { *out=DUR_NONE;    return 0; }
+    if(strcmp(s,"atomic")==0)  { *out=DUR_ATOMIC;  return 0; }
+    if(strcmp(s,"durable")==0) { *out=DUR_DURABLE; return 0; }
+    return -1;
+}
+
+// O_TMPFILE file in dirfd, or -1 where the platform has none (named temps)
+static int open_anon(int dirfd){
+#ifdef O_TMPFILE
+    return openat(dirfd, ".", O_TMPFILE|O_WRONLY|O_CLOEXEC, 0664);
+#else
+    (void)dirfd; errno = EOPNOTSUPP; return -1;
+#endif
+}
+
+static int link_anon(int fd, int dirfd, const char *name){
+    char proc[64]; snprintf(proc, sizeof proc, "/proc/self/fd/%d", fd);
+    return linkat(AT_FDCWD, proc, dirfd, name, AT_SYMLINK_FOLLOW);
+}
+
+// Checks once whether anonymous temp files can be linked into this directory
+static int probe_tmpfile(int dirfd){
+    int fd = open_anon(dirfd);
+    if(fd<0) return 0;
+    char probe[64]; snprintf(probe, sizeof probe, ".calc-probe.%ld", (long)getpid());
+    int ok = link_anon(fd, dirfd, probe)==0;
+    if(ok) unlinkat(dirfd, probe, 0);
+    close(fd);
+    return ok;
+}
+
+static int out_open(OutDir *o, const char *path, Durability dur){
+    memset(o, 0, sizeof *o);
+    o->dir.path = path; o->dur = dur;
+    o->dir.fd = ensure_dir(path);
+    if(o->dir.fd<0) return -1;
+    if(dur==DUR_NONE) return 0;
+    o->use_tmpfile = probe_tmpfile(o->dir.fd);
+    if(dur==DUR_DURABLE){
+        o->pending = (PendingOut*)mem_alloc(MEM_OUTPUT, DURABLE_BATCH * sizeof *o->pending);
+        if(!o->pending){ close(o->dir.fd); return -1; }
+    }
+    return 0;
+}
+
+static void temp_name(const char *name, char *out, size_t outsz){
+    snprintf(out, outsz, ".%s.%ld.tmp", name, (long)getpid());
+}
+
+// Creates the temp file a result is written to before it is published
+static int open_temp(OutDir *o, const char *name, PendingOut *p){
+    snprintf(p->name, sizeof p->name, "%s", name);
+    p->anon = o->use_tmpfile;
+    if(p->anon) p->fd = open_anon(o->dir.fd);
+    else{
+        temp_name(name, p->tmp, sizeof p->tmp);
+        p->fd = openat(o->dir.fd, p->tmp, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0664);
+    }
+    return p->fd<0 ? -1 : 0;
+}
+
+// Gives a finished temp file its final name and closes it
+static int publish(OutDir *o, PendingOut *p){
+    int dfd = o->dir.fd, rc = 0;
+    if(p->anon){
+        if(link_anon(p->fd, dfd, p->name)!=0){
+            // Target exists: stage under a temp name, then rename over it
+            if(errno!=EEXIST) rc = -1;
+            else{
+                temp_name(p->name, p->tmp, sizeof p->tmp);
+                unlinkat(dfd, p->tmp, 0);
+                if(link_anon(p->fd, dfd, p->tmp)!=0 || renameat(dfd, p->tmp, dfd, p->name)!=0) rc = -1;
+            }
+        }
+    } else if(renameat(dfd, p->tmp, dfd, p->name)!=0){ unlinkat(dfd, p->tmp, 0); rc = -1; }
+    if(close(p->fd)!=0) rc = -1;
+    if(rc) report_path("write fail", &o->dir, p->name);
+    return rc;
+}
+
+// Durable mode: fsync every pending file, publish them, fsync the dir once
+static int flush_pending(OutDir *o){
+    int rc = 0;
+    for(size_t i=0;i<o->npending;i++){
+        PendingOut *p = &o->pending[i];
+        if(fsync(p->fd)!=0){ report_path("fsync fail", &o->dir, p->name); rc = -1; }
+    }
+    for(size_t i=0;i<o->npending;i++) if(publish(o, &o->pending[i])!=0) rc = -1;
+    if(o->npending && fsync(o->dir.fd)!=0){ fprintf(stderr,"fsync fail: %s\n", o->dir.path); rc = -1; }
+    o->npending = 0;
+    return rc;
+}
+
+// True when <name> already holds exactly buf: size check first (one fstatat),
+// then a chunked compare, so calc_results.bin is covered as well as the
+// one-line text results.
+static int output_unchanged(OutDir *o, const char *name, const char *buf, size_t len){
+    struct stat st;
+    if(fstatat(o->dir.fd, name, &st, 0)!=0 || !S_ISREG(st.st_mode) || (size_t)st.st_size!=len) return 0;
+    int fd = openat(o->dir.fd, name, O_RDONLY|O_CLOEXEC);
+    if(fd<0) return 0;
+    // Sizes match; stream the old content and stop at the first difference
+    char old[4096]; size_t got = 0; int same = 1;
+    while(same && got < len){
+        size_t want = len - got < sizeof old ? len - got : sizeof old;
+        ssize_t n = read(fd, old, want);
+        if(n<0){ if(errno==EINTR) continue; same = 0; break; }
+        if(n==0){ same = 0; break; }
+        same = memcmp(old, buf + got, (size_t)n)==0;
+        got += (size_t)n;
+    }
+    close(fd);
+    return same && got==len;
+}
+
+// Writes one result file according to the durability mode
+static int write_result(OutDir *o, const char *name, const char *buf, size_t len){
+    if(o->if_changed && output_unchanged(o, name, buf, len)){ o->skipped++; return 0; }
+    o->written++;
+    if(o->dur==DUR_NONE){
+        int fd = openat(o->dir.fd, name, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0664);
+        if(fd<0 || write_all(fd, buf, len)!=0 || close(fd)!=0){ report_path("write fail", &o->dir, name); return -1; }
+        return 0;
+    }
+    PendingOut tmp, *p = (o->dur==DUR_DURABLE) ? &o->pending[o->npending] : &tmp;
+    if(open_temp(o, name, p)!=0){ report_path("write fail", &o->dir, name); return -1; }
+    if(write_all(p->fd, buf, len)!=0){
+        report_path("write fail", &o->dir, name);
+        close(p->fd); if(!p->anon) unlinkat(o->dir.fd, p->tmp, 0);
+        return -1;
+    }
+    if(o->dur==DUR_ATOMIC) return publish(o, p);
+    if(++o->npending == DURABLE_BATCH) return flush_pending(o);
+    return 0;
+}
+
+// ============================== Binary results ==============================
+// --format bin: instead of one text file per input, every result becomes a
+// fixed-width record (see calcbin.h) collected in memory and written as one
+// CALCBIN_FILE when the output directory is closed, through write_result so
+// the durability and --if-changed modes apply to it as well.
+// Keeps the first bytes free for the header, which is filled in at the end
+static int bin_reserve_header(OutDir *o){
+    static const CalcBinHeader blank;
+    if(o->bin_len) return 0;
+    return buf_append(MEM_OUTPUT, &o->bin, &o->bin_len, &o->bin_cap, &blank, sizeof blank);
+}
+
+static int bin_add(OutDir *o, const char *in_name, EvalResult R){
+    CalcBinRecord r; memset(&r, 0, sizeof r);
+    r.status = R.ok ? CALCBIN_OK : CALCBIN_ERROR;
+    if(!R.ok) r.err_pos = R.err_pos;
+    else if(R.v.is_float){ r.tag = CALCBIN_FLOAT; r.v.d = R.v.d; }
+    else { r.tag = CALCBIN_INT; r.v.i = R.v.i; }
+    r.name_off = (uint32_t)o->names_len;
+    if(o->names_len + strlen(in_name) + 1 > UINT32_MAX || bin_reserve_header(o) ||
+       buf_append(MEM_OUTPUT, &o->names, &o->names_len, &o->names_cap, in_name, strlen(in_name) + 1) ||
+       buf_append(MEM_OUTPUT, &o->bin, &o->bin_len, &o->bin_cap, &r, sizeof r)){
+        fprintf(stderr, "out of memory: %s\n", in_name);
+        return -1;
+    }
+    o->bin_count++;
+    return 0;
+}
+
+// Fills in the header, appends the name table and writes the file
+static int bin_finish(OutDir *o){
+    if(bin_reserve_header(o)) return -1;
+    CalcBinHeader h; memset(&h, 0, sizeof h);
+    memcpy(h.magic, CALCBIN_MAGIC, 8);
+    h.version = CALCBIN_VERSION; h.record_size = sizeof(CalcBinRecord);
+    h.count = o->bin_count; h.names_off = o->bin_len;
+    memcpy(o->bin, &h, sizeof h);
+    if(o->names_len && buf_append(MEM_OUTPUT, &o->bin, &o->bin_len, &o->bin_cap, o->names, o->names_len)) return -1;
+    return write_result(o, CALCBIN_FILE, o->bin, o->bin_len);
+}
+
+// Publishes anything still pending and closes the output directory
+static int out_close(OutDir *o){
+    int rc = (o->binary && bin_finish(o)!=0) ? -1 : 0;
+    mem_free(MEM_OUTPUT, o->bin); mem_free(MEM_OUTPUT, o->names); o->bin = o->names = NULL;
+    if(o->pending && flush_pending(o)!=0) rc = -1;
+    mem_free(MEM_OUTPUT, o->pending); o->pending = NULL;
+    if(o->dir.fd>=0) close(o->dir.fd);
+    return rc;
+}
+
+// ============================ Inflate (RFC 1951) ============================
+// Minimal DEFLATE decoder in the style of zlib's puff.c: canonical Huffman
+// codes decoded a bit at a time. Corpus members are small, so simplicity wins
+// over table-driven speed. Output goes to a caller buffer of known size (zip)
+// or a buffer that grows on demand (gzip).
+typedef struct {
+    const unsigned char *in; size_t inlen, inpos;
+    unsigned long bitbuf; int bitcnt;
+    unsigned char *out; size_t outlen, outcap;
+    int growable;       // out may be realloc'ed
+    int err;            // input exhausted / corrupt / output overflow
+} Inflate;
+
+typedef struct { short count[16]; short symbol[288]; } Huff;
+
+static int inf_bits(Inflate *s, int need){
+    unsigned long val = s->bitbuf;
+    while(s->bitcnt < need){
+        if(s->inpos >= s->inlen){ s->err = 1; return 0; }
+        val |= (unsigned long)s->in[s->inpos++] << s->bitcnt;
+        s->bitcnt += 8;
+    }
+    s->bitbuf = val >> need; s->bitcnt -= need;
+    return (int)(val & ((1UL << need) - 1));
+}
+
+// Makes room for n more output bytes
+static int inf_room(Inflate *s, size_t n){
+    if(s->outlen + n <= s->outcap) return 0;
+    if(!s->growable){ s->err = 1; return -1; }
+    size_t cap = s->outcap ? s->outcap : 4096;
+    while(cap < s->outlen + n) cap *= 2;
+    unsigned char *p = (unsigned char*)mem_realloc(MEM_INPUT, s->out, cap + 1);   // +1 keeps room for a NUL
+    if(!p){ s->err = 1; return -1; }
+    s->out = p; s->outcap = cap; return 0;
+}
+
+// Builds canonical code tables; returns <0 if over-subscribed
+static int huff_build(Huff *h, const short *length, int n){
+    short offs[16];
+    memset(h->count, 0, sizeof h->count);
+    for(int i=0;i<n;i++) h->count[length[i]]++;
+    if(h->count[0]==n) return 0;
+    int left = 1;
+    for(int len=1; len<16; len++){ left <<= 1; left -= h->count[len]; if(left<0) return left; }
+    offs[1] = 0;
+    for(int len=1; len<15; len++) offs[len+1] = (short)(offs[len] + h->count[len]);
+    for(int i=0;i<n;i++) if(length[i]) h->symbol[offs[length[i]]++] = (short)i;
+    return left;
+}
+
+static int huff_decode(Inflate *s, const Huff *h){
+    int code = 0, first = 0, index = 0;
+    for(int len=1; len<16; len++){
+        code |= inf_bits(s, 1);
+        if(s->err) return -1;
+        int count = h->count[len];
+        if(code - count < first) return h->symbol[index + (code - first)];
+        index += count; first += count; first <<= 1; code <<= 1;
+    }
+    s->err = 1; return -1;
+}
+
+static int inf_stored(Inflate *s){
+    s->bitbuf = 0; s->bitcnt = 0;
+    if(s->inpos + 4 > s->inlen) return -1;
+    unsigned len = s->in[s->inpos] | (unsigned)s->in[s->inpos+1] << 8;
+    unsigned nlen = s->in[s->inpos+2] | (unsigned)s->in[s->inpos+3] << 8;
+    s->inpos += 4;
+    if(len != (~nlen & 0xffffu) || s->inpos + len > s->inlen || inf_room(s, len)) return -1;
+    memcpy(s->out + s->outlen, s->in + s->inpos, len);
+    s->inpos += len; s->outlen += len;
+    return 0;
+}
+
+static int inf_codes(Inflate *s, const Huff *lencode, const Huff *distcode){
+    static const short lbase[29] = {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+    static const short lext[29]  = {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+    static const short dbase[30] = {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577};
+    static const short dext[30]  = {0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+    for(;;){
+        int sym = huff_decode(s, lencode);
+        if(sym < 0) return -1;
+        if(sym < 256){
+            if(inf_room(s, 1)) return -1;
+            s->out[s->outlen++] = (unsigned char)sym;
+        } else if(sym == 256) return 0;
+        else{
+            sym -= 257;
+            if(sym >= 29) return -1;
+            size_t len = (size_t)(lbase[sym] + inf_bits(s, lext[sym]));
+            int dsym = huff_decode(s, distcode);
+            if(dsym < 0 || dsym >= 30) return -1;
+            size_t dist = (size_t)(dbase[dsym] + inf_bits(s, dext[dsym]));
+            if(s->err || dist > s->outlen || inf_room(s, len)) return -1;
+            unsigned char *o = s->out + s->outlen;
+            for(size_t i=0;i<len;i++) o[i] = o[(ptrdiff_t)i - (ptrdiff_t)dist];   // may overlap
+            s->outlen += len;
+        }
+    }
+}
+
+// Fixed-block tables, built once (pthread_once: --verify workers inflate
+// concurrently)
+static Huff g_fixed_len, g_fixed_dist;
+static pthread_once_t g_fixed_once = PTHREAD_ONCE_INIT;
+static void build_fixed(void){
+    short lengths[288];
+    int i = 0;
+    for(; i<144; i++) lengths[i] = 8;
+    for(; i<256; i++) lengths[i] = 9;
+    for(; i<280; i++) lengths[i] = 7;
+    for(; i<288; i++) lengths[i] = 8;
+    huff_build(&g_fixed_len, lengths, 288);
+    for(i=0;i<30;i++) lengths[i] = 5;
+    huff_build(&g_fixed_dist, lengths, 30);
+}
+
+static int inf_fixed(Inflate *s){
+    pthread_once(&g_fixed_once, build_fixed);
+    return inf_codes(s, &g_fixed_len, &g_fixed_dist);
+}
+
+static int inf_dynamic(Inflate *s){
+    static const short order[19] = {16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15};
+    short lengths[320];
+    Huff lencode, distcode;
+    int nlen = inf_bits(s, 5) + 257, ndist = inf_bits(s, 5) + 1, ncode = inf_bits(s, 4) + 4;
+    if(s->err || nlen > 286 || ndist > 30) return -1;
+    int i = 0;
+    for(; i<ncode; i++) lengths[order[i]] = (short)inf_bits(s, 3);
+    for(; i<19; i++) lengths[order[i]] = 0;
+    if(s->err || huff_build(&lencode, lengths, 19) != 0) return -1;
+    for(i=0; i<nlen+ndist; ){
+        int sym = huff_decode(s, &lencode);
+        if(sym < 0) return -1;
+        if(sym < 16){ lengths[i++] = (short)sym; continue; }
+        short len = 0; int rep;
+        if(sym == 16){ if(i==0) return -1; len = lengths[i-1]; rep = 3 + inf_bits(s, 2); }
+        else if(sym == 17) rep = 3 + inf_bits(s, 3);
+        else rep = 11 + inf_bits(s, 7);
+        if(s->err || i + rep > nlen + ndist) return -1;
+        while(rep--) lengths[i++] = len;
+    }
+    if(lengths[256] == 0) return -1;
+    int err = huff_build(&lencode, lengths, nlen);
+    if(err < 0 || (err > 0 && nlen - lencode.count[0] != 1)) return -1;
+    err = huff_build(&distcode, lengths + nlen, ndist);
+    if(err < 0 || (err > 0 && ndist - distcode.count[0] != 1)) return -1;
+    return inf_codes(s, &lencode, &distcode);
+}
+
+// Decodes a raw DEFLATE stream starting at s->in[s->inpos]; 0 on success
+static int inflate_raw(Inflate *s){
+    int last;
+    do{
+        last = inf_bits(s, 1);
+        int type = inf_bits(s, 2);
+        if(s->err) return -1;
+        int rc = type==0 ? inf_stored(s) : type==1 ? inf_fixed(s) : type==2 ? inf_dynamic(s) : -1;
+        if(rc || s->err) return -1;
+    } while(!last);
+    return 0;
+}
+
+// Little-endian field readers for zip/gzip headers
+static unsigned rd16(const unsigned char *p){ return p[0] | (unsigned)p[1] << 8; }
+static unsigned long rd32(const unsigned char *p){ return rd16(p) | (unsigned long)rd16(p+2) << 16; }
+
+// Standard CRC-32 (zip/gzip), table built once on first use
+static unsigned long g_crc_table[256];
+static pthread_once_t g_crc_once = PTHREAD_ONCE_INIT;
+static void build_crc(void){
+    for(unsigned long i=0;i<256;i++){
+        unsigned long c = i;
+        for(int k=0;k<8;k++) c = (c & 1) ? 0xedb88320UL ^ (c >> 1) : c >> 1;
+        g_crc_table[i] = c;
+    }
+}
+
+static unsigned long crc32_update(unsigned long crc, const unsigned char *p, size_t n){
+    pthread_once(&g_crc_once, build_crc);
+    crc = ~crc & 0xffffffffUL;
+    while(n--) crc = g_crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc & 0xffffffffUL;
+}
+
+// =========================== Compressed inputs ==============================
+// Inputs are sniffed by magic bytes: gzip (1f 8b) is inflated with the decoder
+// above; zstd (28 b5 2f fd) needs a build with -DCALC_WITH_ZSTD -lzstd. Either
+// way the file is decoded in memory (no scratch files), and since evaluation
+// runs over the decoded bytes, ERROR positions are uncompressed offsets.
+static int is_gzip(const unsigned char *p, size_t n){ return n>=2 && p[0]==0x1f && p[1]==0x8b; }
+static int is_zstd(const unsigned char *p, size_t n){ return n>=4 && p[0]==0x28 && p[1]==0xb5 && p[2]==0x2f && p[3]==0xfd; }
+
+// Decodes a (possibly multi-member) gzip file into a new NUL-terminated buffer
+static int gunzip_buffer(const unsigned char *in, size_t inlen, char **out_buf, size_t *out_len){
+    Inflate s; memset(&s,0,sizeof s);
+    s.in = in; s.inlen = inlen; s.growable = 1;
+    // ISIZE of the last member is a good first guess for the output size
+    size_t hint = inlen>=4 ? rd32(in + inlen - 4) : 0;
+    if(hint > inlen * 1032) hint = inlen * 1032;   // deflate cannot expand further
+    if(hint && inf_room(&s, hint)) return -1;
+    size_t pos = 0;
+    while(pos < inlen){
+        const unsigned char *h = in + pos;
+        if(inlen - pos < 18 || !is_gzip(h, inlen - pos) || h[2]!=8){ mem_free(MEM_INPUT, s.out); return -1; }
+        unsigned flg = h[3];
+        size_t q = pos + 10;
+        if(flg & 4){ if(q + 2 > inlen){ mem_free(MEM_INPUT, s.out); return -1; } q += 2 + rd16(in + q); }
+        if(flg & 8){ while(q < inlen && in[q]) q++; q++; }    // file name
+        if(flg & 16){ while(q < inlen && in[q]) q++; q++; }   // comment
+        if(flg & 2) q += 2;                                   // header crc
+        if(q >= inlen){ mem_free(MEM_INPUT, s.out); return -1; }
+        size_t start = s.outlen;
+        s.inpos = q; s.bitbuf = 0; s.bitcnt = 0;
+        if(inflate_raw(&s)!=0 || s.inpos + 8 > inlen){ mem_free(MEM_INPUT, s.out); return -1; }
+        const unsigned char *t = in + s.inpos;
+        if(crc32_update(0, s.out + start, s.outlen - start)!=rd32(t) ||
+           ((s.outlen - start) & 0xffffffffUL)!=rd32(t+4)){ mem_free(MEM_INPUT, s.out); return -1; }
+        pos = s.inpos + 8;
+    }
+    if(!s.out && inf_room(&s, 1)) return -1;
+    s.out[s.outlen] = '\0';
+    *out_buf = (char*)s.out; *out_len = s.outlen;
+    return 0;
+}
+
+#ifdef CALC_WITH_ZSTD
+static int unzstd_buffer(const unsigned char *in, size_t inlen, char **out_buf, size_t *out_len){
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    if(!dctx) return -1;
+    unsigned long long fcs = ZSTD_getFrameContentSize(in, inlen);
+    size_t cap = (fcs!=ZSTD_CONTENTSIZE_UNKNOWN && fcs!=ZSTD_CONTENTSIZE_ERROR && fcs < ((size_t)-1)/2) ? (size_t)fcs : inlen*4 + 4096;
+    if(cap==0) cap = 1;
+    char *out = (char*)mem_alloc(MEM_INPUT, cap + 1);
+    size_t len = 0;
+    ZSTD_inBuffer ib = { in, inlen, 0 };
+    int rc = -1;
+    while(out){
+        if(len == cap){
+            char *nb = (char*)mem_realloc(MEM_INPUT, out, cap*2 + 1);
+            if(!nb) break;
+            out = nb; cap *= 2;
+        }
+        ZSTD_outBuffer ob = { out + len, cap - len, 0 };
+        size_t r = ZSTD_decompressStream(dctx, &ob, &ib);
+        if(ZSTD_isError(r)) break;
+        len += ob.pos;
+        if(r==0 && ib.pos==ib.size){ rc = 0; break; }
+        if(ib.pos==ib.size && ob.pos < ob.size) break;   // truncated frame
+    }
+    ZSTD_freeDCtx(dctx);
+    if(rc){ mem_free(MEM_INPUT, out); return -1; }
+    out[len] = '\0';
+    *out_buf = out; *out_len = len;
+    return 0;
+}
+#endif
+
+// Reads an input file, transparently decoding gzip/zstd content
+static int load_input(int dirfd, const char *path, char **out_buf, size_t *out_len){
+    char *raw; size_t n;
+    if(read_entire_file(dirfd, path, &raw, &n)!=0) return -1;
+    const unsigned char *u = (const unsigned char*)raw;
+    int rc = 0;
+    if(is_gzip(u, n)){
+        rc = gunzip_buffer(u, n, out_buf, out_len);
+        mem_free(MEM_INPUT, raw);
+    } else if(is_zstd(u, n)){
+#ifdef CALC_WITH_ZSTD
+        rc = unzstd_buffer(u, n, out_buf, out_len);
+#else
+        fprintf(stderr,"zstd input not supported (build with -DCALC_WITH_ZSTD)\n");
+        rc = -1;
+#endif
+        mem_free(MEM_INPUT, raw);
+    } else { *out_buf = raw; *out_len = n; }
+    return rc;
+}
+
+// ================================= Progress =================================
+// SIGUSR1 (and the --progress-interval timer, via SIGALRM) only sets a flag;
+// the processing loops check it between inputs and run poll_work, which
+// prints a progress line to stderr. Each thread counts into its own ProgCount (single writer, so plain
+// relaxed load/store, no locked instructions) and the report sums the list.
+// The -d total is only counted, with a second pass over the directory, the
+// first time a report is asked for.
+typedef struct ProgCount {
+    atomic_ullong files, bytes, exprs, errors, div_zero;
+    struct ProgCount *next;
+} ProgCount;
+
+static volatile sig_atomic_t g_poll_due;   // run poll_work() at the next input boundary
+static volatile sig_atomic_t g_usr1;
+static _Atomic(ProgCount*) g_prog_list;
+static _Thread_local ProgCount *t_prog;
+static double g_prog_t0;
+static unsigned long long g_prog_total_files, g_prog_total_bytes;   // 0: not known (yet)
+static const char *g_prog_dir;                                        // -d DIR to count lazily
+
+static void on_usr1(int sig){ (void)sig; g_usr1 = 1; g_poll_due = 1; }
+static void on_alarm(int sig){ (void)sig; g_poll_due = 1; }
+
+static void prog_bump(atomic_ullong *a, unsigned long long n){
+    atomic_store_explicit(a, atomic_load_explicit(a, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static void progress_add(unsigned long long files, unsigned long long bytes, unsigned long long exprs, EvalResult R){
+    ProgCount *c = t_prog;
+    if(!c){
+        if(!(c = (ProgCount*)mem_alloc(MEM_INSTR, sizeof *c))) return;
+        memset(c, 0, sizeof *c);
+        c->next = atomic_load(&g_prog_list);
+        while(!atomic_compare_exchange_weak(&g_prog_list, &c->next, c)) {}
+        t_prog = c;
+    }
+    if(files) prog_bump(&c->files, files);
+    prog_bump(&c->bytes, bytes);
+    prog_bump(&c->exprs, exprs);
+    if(!R.ok){ prog_bump(&c->errors, 1); if(R.div_zero) prog_bump(&c->div_zero, 1); }
+}
+
+static void fmt_secs(char *buf, size_t n, double s){
+    if(s < 60) snprintf(buf, n, "%.1fs", s);
+    else if(s < 3600) snprintf(buf, n, "%dm%02ds", (int)(s/60), (int)s % 60);
+    else snprintf(buf, n, "%dh%02dm", (int)(s/3600), (int)(s/60) % 60);
+}
+
+static void progress_report(void){
+    if(g_prog_dir && !g_prog_total_files){
+        DIR *d = opendir(g_prog_dir);
+        struct dirent *e;
+        if(d){ while((e=readdir(d))!=NULL) if(is_input_name(e->d_name)) g_prog_total_files++; closedir(d); }
+    }
+    unsigned long long files = 0, bytes = 0, exprs = 0, errors = 0;
+    for(ProgCount *c = atomic_load(&g_prog_list); c; c = c->next){
+        files += atomic_load_explicit(&c->files, memory_order_relaxed);
+        bytes += atomic_load_explicit(&c->bytes, memory_order_relaxed);
+        exprs += atomic_load_explicit(&c->exprs, memory_order_relaxed);
+        errors += atomic_load_explicit(&c->errors, memory_order_relaxed);
+    }
+    double el = mono_now() - g_prog_t0;
+    char els[32], eta[32] = "?";
+    fmt_secs(els, sizeof els, el);
+    double done = -1;   // fraction
+    if(g_prog_total_files) done = (double)files / (double)g_prog_total_files;
+    else if(g_prog_total_bytes) done = (double)bytes / (double)g_prog_total_bytes;
+    if(done > 0) fmt_secs(eta, sizeof eta, el / done - el);
+    fputs("progress: ", stderr);
+    if(files || g_prog_total_files) fprintf(stderr, "%llu", files);
+    if(g_prog_total_files) fprintf(stderr, "/%llu", g_prog_total_files);
+    if(files || g_prog_total_files) fputs(" files, ", stderr);
+    fprintf(stderr, "%llu expressions, %llu errors, %.2f MB/s, %.0f expr/s, elapsed %s",
+            exprs, errors, el>0 ? bytes/1e6/el : 0.0, el>0 ? exprs/el : 0.0, els);
+    if(done >= 0) fprintf(stderr, ", %.1f%% done, ETA %s", done*100, eta);
+    fputc('\n', stderr);
+}
+
+// Releases the per-thread counters (at exit)
+static void progress_done(void){
+    for(ProgCount *c = atomic_exchange(&g_prog_list, NULL), *next; c; c = next){ next = c->next; mem_free(MEM_INSTR, c); }
+    t_prog = NULL;
+}
+
+// ================================= Metrics ==================================
+// --metrics FILE.prom: Prometheus text-format snapshot for node_exporter's
+// textfile collector, rewritten every --metrics-interval (default 10s) from
+// the same input-boundary poll as --progress-interval, and once more at exit.
+// Each snapshot is written to FILE.prom.tmp and renamed over FILE.prom, so a
+// scrape never sees a partial file. Counters come from the progress counters;
+// the latency histogram is the --latency one folded into fixed buckets (a
+// log-linear bucket counts under the first bound at or above its top, so
+// bounds are exact to the ~3% bucket width).
+static const char *g_metrics_path;
+static const OutDir *g_metrics_out;   // for the --if-changed hit count
+static const double metric_bounds[] = { 1e-6, 5e-6, 1e-5, 5e-5, 1e-4, 5e-4, 1e-3, 5e-3, 1e-2, 5e-2, 0.1, 0.5, 1, 5 };
+#define N_METRIC_BOUNDS (sizeof metric_bounds / sizeof *metric_bounds)
+
+static void metric_head(FILE *f, const char *name, const char *type, const char *help){
+    fprintf(f, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static int metrics_write(void){
+    unsigned long long files = 0, bytes = 0, exprs = 0, errors = 0, div_zero = 0;
+    for(ProgCount *c = atomic_load(&g_prog_list); c; c = c->next){
+        files += atomic_load_explicit(&c->files, memory_order_relaxed);
+        bytes += atomic_load_explicit(&c->bytes, memory_order_relaxed);
+        exprs += atomic_load_explicit(&c->exprs, memory_order_relaxed);
+        errors += atomic_load_explicit(&c->errors, memory_order_relaxed);
+        div_zero += atomic_load_explicit(&c->div_zero, memory_order_relaxed);
+    }
+    char tmp[4096];
+    snprintf(tmp, sizeof tmp, "%s.tmp", g_metrics_path);
+    FILE *f = fopen(tmp, "w");
+    if(!f){ fprintf(stderr,"write fail: %s\n", tmp); return -1; }
+    metric_head(f, "calc_files_total", "counter", "Input files (or archive members) evaluated.");
+    fprintf(f, "calc_files_total %llu\n", files);
+    metric_head(f, "calc_bytes_total", "counter", "Expression bytes evaluated.");
+    fprintf(f, "calc_bytes_total %llu\n", bytes);
+    metric_head(f, "calc_expressions_total", "counter", "Expressions evaluated.");
+    fprintf(f, "calc_expressions_total %llu\n", exprs);
+    metric_head(f, "calc_errors_total", "counter", "Expressions that produced ERROR, by kind.");
+    fprintf(f, "calc_errors_total{kind=\"syntax\"} %llu\ncalc_errors_total{kind=\"div_by_zero\"} %llu\n", errors - div_zero, div_zero);
+    metric_head(f, "calc_cache_hits_total", "counter", "Outputs left untouched because their content was already identical (--if-changed).");
+    fprintf(f, "calc_cache_hits_total %zu\n", g_metrics_out ? g_metrics_out->skipped : (size_t)0);
+    static LatHist m;
+    lat_merge(&m);
+    for(int k=0;k<LAT_KINDS;k++){
+        if(!m.n[k] && k==LAT_EXPR) continue;
+        char name[64];
+        snprintf(name, sizeof name, "calc_%s_latency_seconds", lat_names[k]);
+        metric_head(f, name, "histogram", k==LAT_FILE ? "Time to read, evaluate and write one input file." : "Time to evaluate and emit one NDJSON record.");
+        unsigned long long cum = 0; unsigned i = 0;
+        for(size_t b=0;b<N_METRIC_BOUNDS;b++){
+            unsigned long long le = (unsigned long long)(metric_bounds[b] * 1e9);
+            for(; i<LAT_BUCKETS && lat_bucket_top(i) <= le; i++) cum += m.count[k][i];
+            fprintf(f, "%s_bucket{le=\"%g\"} %llu\n", name, metric_bounds[b], cum);
+        }
+        fprintf(f, "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %.9f\n%s_count %llu\n", name, m.n[k], name, m.sum[k] / 1e9, name, m.n[k]);
+    }
+    metric_head(f, "calc_last_update_timestamp_seconds", "gauge", "Unix time of this snapshot.");
+    fprintf(f, "calc_last_update_timestamp_seconds %lld\n", (long long)time(NULL));
+    if((ferror(f) | fclose(f)) || rename(tmp, g_metrics_path)!=0){
+        fprintf(stderr,"write fail: %s\n", g_metrics_path);
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+// Periodic work, run by the processing loops between inputs when a signal
+// (SIGUSR1, or the SIGALRM tick) has set g_poll_due
+static double g_progress_every, g_metrics_every = 10, g_progress_next, g_metrics_next;
+
+static void poll_work(void){
+    g_poll_due = 0;
+    double now = mono_now();
+    if(g_usr1){ g_usr1 = 0; progress_report(); }
+    else if(g_progress_every > 0 && now >= g_progress_next){ progress_report(); g_progress_next = now + g_progress_every; }
+    if(g_metrics_path && now >= g_metrics_next){ metrics_write(); g_metrics_next = now + g_metrics_every; }
+}
+
+// Installs the signal handlers and one interval timer ticking at the
+// shortest period any periodic job needs
+static void poll_init(double progress_every){
+    g_progress_every = progress_every;
+    g_prog_t0 = mono_now();
+    g_progress_next = g_prog_t0 + progress_every;
+    g_metrics_next = g_prog_t0 + g_metrics_every;
+    struct sigaction sa; memset(&sa, 0, sizeof sa);
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_handler = on_usr1;
+    sigaction(SIGUSR1, &sa, NULL);
+    double tick = progress_every;
+    if(g_metrics_path && (tick <= 0 || g_metrics_every < tick)) tick = g_metrics_every;
+    if(tick <= 0) return;
+    sa.sa_handler = on_alarm;
+    sigaction(SIGALRM, &sa, NULL);
+    struct itimerval it; memset(&it, 0, sizeof it);
+    it.it_interval.tv_sec = (time_t)tick;
+    it.it_interval.tv_usec = (suseconds_t)((tick - (double)(time_t)tick) * 1e6);
+    if(!it.it_interval.tv_sec && !it.it_interval.tv_usec) it.it_interval.tv_usec = 1;
+    it.it_value = it.it_interval;
+    setitimer(ITIMER_REAL, &it, NULL);
+}
+
 // ================================= CLI ======================================
 // Command line parsing and usage help
-typedef struct { const char *dir; const char *outdir; const char *input; } Options;
+typedef struct { const char *dir; const char *zip; const char *outdir; const char *input; Durability durability; int if_changed;
+                 int binary; const char *bin_to_text; int ndjson; const char *aggregate;
+                 int stats; int perf_counters; const char *trace; int latency; int mem_stats; int check_noalloc; int profile_ops;
+                 const char *slow_log; double progress_interval;
+                 const char *metrics; double metrics_interval; const char *verify; int jobs;
+                 const char *isa; int cpu_features; } Options;
 
 static void usage(const char *prog){
     fprintf(stderr,
-      "Usage: %s [-d DIR|--dir DIR] [-o OUTDIR|--output-dir OUTDIR] input.txt\n"
+      "Usage: %s [-d DIR|--dir DIR] [--zip ARCHIVE] [-o OUTDIR|--output-dir OUTDIR]\n"
+      "          [--durability none|atomic|durable] [--if-changed]\n"
+      "          [--format text|bin] [--bin-to-text RESULTS.bin]\n"
+      "          [--aggregate sum,min,max,mean,count,errors]\n"
+      "          [--stats|--stats=json] [--perf-counters] [--trace OUT.json]\n"
+      "          [--latency] [--mem-stats] [--profile-ops]\n"
+      "          [--slow-log FILE [--slow-threshold T]] [--progress-interval T]\n"
+      "          [--metrics FILE.prom [--metrics-interval T]] input.txt\n"
+      "       %s --ndjson [--aggregate FIELDS] [--stats] [--latency] [--mem-stats]\n"
+      "          [--profile-ops] [--slow-log FILE [--slow-threshold T]]\n"
+      "          [--progress-interval T] [--metrics FILE.prom [--metrics-interval T]]\n"
+      "          [FILE|-]\n"
+      "       %s --verify DIR [--jobs N] [--mem-stats] [--progress-interval T]\n"
+      "       %s --check-noalloc | --cpu-features [--isa LEVEL]\n"
       "If -d is given, processes all *.txt in DIR (non-recursive).\n"
-      "If -o omitted, output dir is <input_base>_<username>_%s\n",
-      prog, STUDENT_ID);
+      "If --zip is given, processes all *.txt members of ARCHIVE in place.\n"
+      "If -o omitted, output dir is <input_base>_<username>_%s\n"
+      "--durability: none (default, in place), atomic (temp file + rename),\n"
+      "              durable (atomic + batched fsync of files and directory)\n"
+      "--if-changed: do not rewrite outputs whose content is already identical\n"
+      "--format bin: write all results as fixed-width records to OUTDIR/%s\n"
+      "--bin-to-text: convert such a file back to per-input text outputs\n"
+      "--ndjson: read JSON records with an \"expr\" string (stdin if no FILE) and\n"
+      "          print each with \"result\" or \"error_pos\" added to stdout\n"
+      "          (one output line per input line; non-objects become errors)\n"
+      "--aggregate: fold the results (-d, --zip, --ndjson, input) and print only\n"
+      "             the listed summary fields instead of writing per-input output\n"
+      "--stats: print phase timings and counters to stderr (--stats=json: JSON)\n"
+      "--perf-counters: add cycles/instructions/branch and cache misses per phase\n"
+      "--trace: write per-file/per-stage spans in Chrome trace format (Perfetto)\n"
+      "--latency: print p50/p90/p99/p99.9/max latency per file (and per --ndjson\n"
+      "           record) to stderr, with the slowest inputs\n"
+      "--mem-stats: count allocations and bytes per call site, report peak RSS,\n"
+      "             and fail if a buffer is still allocated at exit\n"
+      "--check-noalloc: verify that evaluation makes no heap calls once warm\n"
+      "                 (needs a build with -DCALC_ALLOC_CHECK)\n"
+      "--profile-ops: count and time each operation by operand types (int, float,\n"
+      "               mixed) and list the expressions with the most op time\n"
+      "--slow-log: list every input whose evaluation takes at least T (default\n"
+      "            5ms; units ns/us/ms/s) to FILE with its size, tokens and depth\n"
+      "--progress-interval: print progress to stderr every T (e.g. 10s); kill -USR1\n"
+      "                     prints it on demand in any mode\n"
+      "--metrics: keep FILE.prom (Prometheus textfile collector format) updated\n"
+      "           every --metrics-interval (default 10s) and at exit\n"
+      "--verify: evaluate each NAME.txt in DIR that has a NAME_output.txt, compare\n"
+      "          in memory (no files written) and list failures; --jobs threads\n"
+      "          (default: one per CPU); exit status 1 if any case fails; the\n"
+      "          --stats/--trace/--latency/--slow-log/--metrics family is refused\n"
+      "--cpu-features: show the CPU's SIMD levels and the scanner kernels in use\n"
+      "--isa scalar|sse4.2|avx2|avx512bw: force that kernel level (any mode)\n",
+      prog, prog, prog, prog, STUDENT_ID, CALCBIN_FILE);
 }
 static int parse_args(int argc, char **argv, Options *opt){
     memset(opt,0,sizeof *opt);
     for(int i=1;i<argc;i++){
         if(strcmp(argv[i],"-d")==0 || strcmp(argv[i],"--dir")==0){
             if(i+1>=argc){ usage(argv[0]); return -1; } opt->dir = argv[++i];
+        } else if(strcmp(argv[i],"--zip")==0){
+            if(i+1>=argc){ usage(argv[0]); return -1; } opt->zip = argv[++i];
         } else if(strcmp(argv[i],"-o")==0 || strcmp(argv[i],"--output-dir")==0){
             if(i+1>=argc){ usage(argv[0]); return -1; } opt->outdir = argv[++i];
-        } else if(argv[i][0]=='-'){ usage(argv[0]); return -1; }
+        } else if(strcmp(argv[i],"--durability")==0){
+            if(i+1>=argc || parse_durability(argv[i+1], &opt->durability)!=0){ usage(argv[0]); return -1; }
+            i++;
+        } else if(strcmp(argv[i],"--format")==0){
+            if(i+1>=argc || (strcmp(argv[i+1],"text")!=0 && strcmp(argv[i+1],"bin")!=0)){ usage(argv[0]); return -1; }
+            opt->binary = strcmp(argv[++i],"bin")==0;
+        } else if(strcmp(argv[i],"--bin-to-text")==0){
+            if(i+1>=argc){ usage(argv[0]); return -1; } opt->bin_to_text = argv[++i];
+        } else if(strcmp(argv[i],"--aggregate")==0){
+            Agg probe;
+            if(i+1>=argc || agg_parse(&probe, argv[i+1])!=0){ usage(argv[0]); return -1; }
+            opt->aggregate = argv[++i];
+        } else if(strcmp(argv[i],"--stats")==0 || strcmp(argv[i],"--stats=text")==0){
+            opt->stats = 1;
+        } else if(strcmp(argv[i],"--stats=json")==0){
+            opt->stats = 2;
+        } else if(strcmp(argv[i],"--trace")==0){
+            if(i+1>=argc){ usage(argv[0]); return -1; } opt->trace = argv[++i];
+        } else if(strcmp(argv[i],"--metrics")==0){
+            if(i+1>=argc){ usage(argv[0]); return -1; } opt->metrics = argv[++i];
+        } else if(strcmp(argv[i],"--metrics-interval")==0){
+            if(i+1>=argc || parse_duration(argv[i+1], &opt->metrics_interval)!=0 || opt->metrics_interval<=0){ usage(argv[0]); return -1; }
+            i++;
+        } else if(strcmp(argv[i],"--progress-interval")==0){
+            if(i+1>=argc || parse_duration(argv[i+1], &opt->progress_interval)!=0){ usage(argv[0]); return -1; }
+            i++;
+        } else if(strcmp(argv[i],"--slow-log")==0){
+            if(i+1>=argc){ usage(argv[0]); return -1; } opt->slow_log = argv[++i];
+        } else if(strcmp(argv[i],"--slow-threshold")==0){
+            if(i+1>=argc || parse_duration(argv[i+1], &g_slow_threshold)!=0){ usage(argv[0]); return -1; }
+            i++;
+        } else if(strcmp(argv[i],"--profile-ops")==0){
+            opt->profile_ops = 1;
+        } else if(strcmp(argv[i],"--check-noalloc")==0){
+            opt->check_noalloc = 1;
+        } else if(strcmp(argv[i],"--mem-stats")==0){
+            opt->mem_stats = 1;
+        } else if(strcmp(argv[i],"--latency")==0){
+            opt->latency = 1;
+        } else if(strcmp(argv[i],"--perf-counters")==0){
+            opt->perf_counters = 1;
+        } else if(strcmp(argv[i],"--ndjson")==0){
+            opt->ndjson = 1;
+        } else if(strcmp(argv[i],"--verify")==0){
+            if(i+1>=argc){ usage(argv[0]); return -1; } opt->verify = argv[++i];
+        } else if(strcmp(argv[i],"--jobs")==0){
+            if(i+1>=argc || atoi(argv[i+1])<=0){ usage(argv[0]); return -1; }
+            opt->jobs = atoi(argv[++i]);
+        } else if(strcmp(argv[i],"--isa")==0){
+            if(i+1>=argc){ usage(argv[0]); return -1; } opt->isa = argv[++i];
+        } else if(strcmp(argv[i],"--cpu-features")==0){
+            opt->cpu_features = 1;
+        } else if(strcmp(argv[i],"--if-changed")==0){
+            opt->if_changed = 1;
+        } else if(argv[i][0]=='-' && strcmp(argv[i],"-")!=0){ usage(argv[0]); return -1; }
         else opt->input = argv[i];
     }
-    if(!opt->dir && !opt->input){ usage(argv[0]); return -1; }
+    if(!opt->dir && !opt->zip && !opt->input && !opt->bin_to_text && !opt->ndjson && !opt->check_noalloc && !opt->verify && !opt->cpu_features){ usage(argv[0]); return -1; }
+    // --verify workers bypass the instrumentation, so refuse it rather than
+    // silently printing nothing
+    if(opt->verify && (opt->stats || opt->perf_counters || opt->trace || opt->latency || opt->slow_log ||
+                       opt->metrics || opt->profile_ops || opt->aggregate)){
+        fprintf(stderr,"--verify takes only --jobs, --mem-stats, --progress-interval and --isa\n");
+        usage(argv[0]); return -1;
+    }
     return 0;
 }
 
 // =============================== Processing =================================
 // Processes one or more input files and generates output results
-static int process_one_file(const char *in_path, const char *out_dir){
+// Evaluates one input already in memory; in_name decides the output name
+static int process_buffer(const char *in_name, const char *buf, size_t len, OutDir *out){
+    EvalResult R = eval_counted(buf,len);
+    progress_add(1, len, 1, R);
+    if(g_stats_on) g_stats.files++;
+    if(out->agg){ agg_add(out->agg, R); return 0; }
+    if(out->binary) return bin_add(out, in_name, R);
+    Stamp t = {0}; if(g_instr) t = stamp_now();
+    char outname[512]; build_output_filename(in_name, outname, sizeof outname);
+    char res[64]; int n = format_result(res, sizeof res, R);
+    if(g_instr) mark_phase(PH_FORMAT, &t);
+    int rc = write_result(out, outname, res, (size_t)n);
+    if(g_instr) mark_phase(PH_OUTPUT, &t);
+    return rc;
+}
+
+static int process_one_file(const DirRef *in_dir, const char *in_name, OutDir *out){
     char *buf=NULL; size_t len=0;
-    if(read_entire_file(in_path,&buf,&len)!=0){ fprintf(stderr,"read fail: %s\n", in_path); return -1; }
-    EvalResult R = eval_buffer(buf,len);
+    if(g_prof_on) prof_expr_begin();
+    Stamp t = {0}; if(g_instr) t = stamp_now();
+    if(load_input(in_dir->fd,in_name,&buf,&len)!=0){ report_path("read fail", in_dir, in_name); return -1; }
+    double file_t0 = t.wall;
+    if(g_instr) mark_phase(PH_READ, &t);
+    if(g_slow_on) slow_source(in_dir->path, '/', in_name, 0);
+    int rc = process_buffer(in_name, buf, len, out);
+    mem_free(MEM_INPUT, buf);
+    if(g_trace_on || g_lat_on){
+        double t1 = mono_now();
+        if(g_trace_on) trace_span("file", file_t0, t1, in_name);
+        if(g_lat_on) lat_record(LAT_FILE, file_t0, t1, in_dir->path, '/', in_name, 0);
+    }
+    if(g_prof_on) prof_expr_end(in_dir->path, '/', in_name, 0);
+    return rc;
+}
+
+// task1.txt.gz and task1.txt.zst write the same output file as task1.txt, so
+// a compressed input with a task1.txt (or, for .zst, a .txt.gz) next to it
+// would silently overwrite or be overwritten: the plainest one wins and the
+// others are reported
+static int shadowed_input(int dirfd, const char *name){
+    int zst = ends_with(name, ".txt.zst");
+    if(!zst && !ends_with(name, ".txt.gz")) return 0;
+    char sib[512];
+    size_t stem = strlen(name) - (zst ? 4 : 3);   // up to and including ".txt"
+    if(stem + 4 > sizeof sib) return 0;
+    memcpy(sib, name, stem); sib[stem] = '\0';
+    if(faccessat(dirfd, sib, F_OK, 0)==0) return 1;
+    memcpy(sib + stem, ".gz", 4);
+    return zst && faccessat(dirfd, sib, F_OK, 0)==0;
+}
+
+static int process_dir(const char *dir, OutDir *out){
+    DIR *d = opendir(dir);
+    if(!d){ fprintf(stderr,"open dir fail: %s\n", dir); return -1; }
+    DirRef in = { dir, dirfd(d) };
+    double t0 = g_trace_on ? mono_now() : 0;
+    struct dirent *e; int rc=0;
+    while((e=readdir(d))!=NULL){
+        if(strcmp(e->d_name,".")==0 || strcmp(e->d_name,"..")==0) continue;
+        if(!is_input_name(e->d_name)) continue;
+        if(shadowed_input(in.fd, e->d_name)){ report_path("output name collision, skipped", &in, e->d_name); rc=-1; continue; }
+        if(process_one_file(&in, e->d_name, out)!=0) rc=-1;
+        if(g_poll_due) poll_work();
+    }
+    closedir(d);
+    if(g_trace_on) trace_span("dir", t0, mono_now(), dir);
+    return rc;
+}
+
+// ============================== Zip archives ================================
+// --zip: evaluates every *.txt member of a zip archive straight from the
+// mmap'ed file. Members are handled one at a time: decompress into a reused
+// buffer, evaluate, write, move on, so nothing is extracted to disk and
+// memory stays at the size of the largest member. Stored (0) and deflate (8)
+// members are supported; zip64 and encrypted members are reported and skipped.
+// Output names come from the member's base name, so a/task1.txt and
+// b/task1.txt would write the same file: the first one wins and later ones
+// are reported as collisions.
+
+// Base names already used in this archive: open addressing over slices of
+// the mapped central directory (no copies)
+typedef struct { const char *s; size_t n; } NameRef;
+typedef struct { NameRef *slot; size_t mask; } NameSet;
+
+static int nameset_init(NameSet *ns, size_t n){
+    size_t cap = 16;
+    while(cap < 2*n) cap *= 2;
+    ns->slot = (NameRef*)mem_alloc(MEM_INPUT, cap * sizeof *ns->slot);
+    if(!ns->slot) return -1;
+    memset(ns->slot, 0, cap * sizeof *ns->slot);
+    ns->mask = cap - 1;
+    return 0;
+}
+
+// Adds s[0..n); returns 1 if it was already there
+static int nameset_add(NameSet *ns, const char *s, size_t n){
+    uint64_t h = 1469598103934665603ULL;   // FNV-1a
+    for(size_t i=0;i<n;i++) h = (h ^ (unsigned char)s[i]) * 1099511628211ULL;
+    for(size_t i = (size_t)h & ns->mask; ; i = (i + 1) & ns->mask){
+        NameRef *r = &ns->slot[i];
+        if(!r->s){ r->s = s; r->n = n; return 0; }
+        if(r->n==n && memcmp(r->s, s, n)==0) return 1;
+    }
+}
+static int process_zip(const char *zip_path, OutDir *out){
+    int fd = open(zip_path, O_RDONLY|O_CLOEXEC);
+    struct stat st;
+    if(fd<0 || fstat(fd,&st)!=0){ fprintf(stderr,"read fail: %s\n", zip_path); if(fd>=0) close(fd); return -1; }
+    size_t size = (size_t)st.st_size;
+    const unsigned char *base = size ? (const unsigned char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if(base==MAP_FAILED || size < 22){ fprintf(stderr,"bad zip: %s\n", zip_path); if(base && base!=MAP_FAILED) munmap((void*)base, size); return -1; }
+    const unsigned char *end = base + size;
+
+    // End-of-central-directory record: last 22 bytes plus up to 64K of comment
+    const unsigned char *eocd = NULL;
+    for(const unsigned char *p = end - 22; ; p--){
+        if(rd32(p)==0x06054b50UL){ eocd = p; break; }
+        if(p==base || (size_t)(end - p) >= 22 + 0xffff) break;
+    }
+    if(!eocd){ fprintf(stderr,"bad zip: %s\n", zip_path); munmap((void*)base, size); return -1; }
+    unsigned nentries = rd16(eocd+10);
+    unsigned long cdoff = rd32(eocd+16);
+    // 65535 entries is a valid plain zip; zip64 is marked by its locator
+    // right before the EOCD (or by an offset that does not fit)
+    int zip64 = cdoff==0xffffffffUL || (eocd - base >= 20 && rd32(eocd - 20)==0x07064b50UL);
+    if(zip64){ fprintf(stderr,"zip64 not supported: %s\n", zip_path); munmap((void*)base, size); return -1; }
+    if(cdoff > size){ fprintf(stderr,"bad zip: %s\n", zip_path); munmap((void*)base, size); return -1; }
+    g_prog_total_files += nentries;   // progress: includes any non-.txt members
+
+    NameSet seen;
+    if(nameset_init(&seen, nentries)!=0){ fprintf(stderr,"out of memory\n"); munmap((void*)base, size); return -1; }
+    unsigned char *buf = NULL; size_t cap = 0;
+    int rc = 0;
+    const unsigned char *p = base + cdoff;
+    for(unsigned k=0; k<nentries; k++){
+        if(p + 46 > end || rd32(p)!=0x02014b50UL){ fprintf(stderr,"bad zip: %s\n", zip_path); rc = -1; break; }
+        unsigned flags = rd16(p+8), method = rd16(p+10);
+        unsigned long crc = rd32(p+16), csize = rd32(p+20), usize = rd32(p+24), loff = rd32(p+42);
+        size_t nlen = rd16(p+28);
+        const unsigned char *next = p + 46 + nlen + rd16(p+30) + rd16(p+32);
+        char name[512];
+        if(p + 46 + nlen > end || nlen >= sizeof name){ fprintf(stderr,"bad zip: %s\n", zip_path); rc = -1; break; }
+        memcpy(name, p+46, nlen); name[nlen] = '\0';
+        const char *cdname = (const char*)p + 46;
+        p = next;
+        if(!ends_with_txt(base_name(name))) continue;
+
+        if(flags & 1){ fprintf(stderr,"encrypted zip entry skipped: %s:%s\n", zip_path, name); rc = -1; continue; }
+        if(loff > size || size - loff < 30){ fprintf(stderr,"bad zip entry: %s:%s\n", zip_path, name); rc = -1; continue; }
+        const unsigned char *lh = base + loff;
+        if(rd32(lh)!=0x04034b50UL){ fprintf(stderr,"bad zip entry: %s:%s\n", zip_path, name); rc = -1; continue; }
+        const unsigned char *data = lh + 30 + rd16(lh+26) + rd16(lh+28);
+        if(data > end || csize > (size_t)(end - data)){ fprintf(stderr,"bad zip entry: %s:%s\n", zip_path, name); rc = -1; continue; }
+        if(usize + 1 > cap){
+            unsigned char *nb = (unsigned char*)mem_realloc(MEM_INPUT, buf, usize + 1);
+            if(!nb){ fprintf(stderr,"out of memory: %s:%s\n", zip_path, name); rc = -1; continue; }
+            buf = nb; cap = usize + 1;
+        }
+        Stamp t = {0}; if(g_instr) t = stamp_now();
+        int ok;
+        if(method==0) ok = (csize==usize) && (memcpy(buf, data, usize), 1);
+        else if(method==8){
+            Inflate s; memset(&s,0,sizeof s);
+            s.in = data; s.inlen = csize; s.out = buf; s.outcap = usize;
+            ok = inflate_raw(&s)==0 && s.outlen==usize;
+        } else { fprintf(stderr,"unsupported zip method %u: %s:%s\n", method, zip_path, name); rc = -1; continue; }
+        if(!ok || crc32_update(0, buf, usize)!=crc){ fprintf(stderr,"bad zip entry: %s:%s\n", zip_path, name); rc = -1; continue; }
+        buf[usize] = '\0';
+        // Only a member that will be written claims its output name
+        size_t boff = (size_t)(base_name(name) - name);
+        if(nameset_add(&seen, cdname + boff, nlen - boff)){
+            fprintf(stderr,"output name collision, skipped: %s:%s\n", zip_path, name); rc = -1; continue;
+        }
+        double member_t0 = t.wall;
+        if(g_instr) mark_phase(PH_READ, &t);
+        if(g_prof_on) prof_expr_begin();
+        if(g_slow_on) slow_source(zip_path, ':', name, 0);
+        if(process_buffer(name, (const char*)buf, usize, out)!=0) rc = -1;
+        if(g_trace_on || g_lat_on){
+            double t1 = mono_now();
+            if(g_trace_on) trace_span("file", member_t0, t1, name);
+            if(g_lat_on) lat_record(LAT_FILE, member_t0, t1, zip_path, ':', name, 0);
+        }
+        if(g_prof_on) prof_expr_end(zip_path, ':', name, 0);
+        if(g_poll_due) poll_work();
+    }
+    mem_free(MEM_INPUT, buf);
+    mem_free(MEM_INPUT, seen.slot);
+    munmap((void*)base, size);
+    return rc;
+}
+
+// --bin-to-text: turns a CALCBIN_FILE back into today's per-input text files
+static int bin_to_text(const char *path, OutDir *out){
+    int fd = open(path, O_RDONLY|O_CLOEXEC);
+    struct stat st;
+    if(fd<0 || fstat(fd,&st)!=0){ fprintf(stderr,"read fail: %s\n", path); if(fd>=0) close(fd); return -1; }
+    size_t size = (size_t)st.st_size;
+    void *map = size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    CalcBinView v;
+    if(map==MAP_FAILED || calcbin_view(&v, map, size)!=0){
+        fprintf(stderr,"bad result file: %s\n", path);
+        if(map!=MAP_FAILED) munmap(map, size);
+        return -1;
+    }
+    int rc = 0;
+    for(uint64_t n=0; n<v.hdr->count; n++){
+        const CalcBinRecord *r = calcbin_record(&v, n);
+        const char *name = calcbin_name(&v, r);
+        if(!name){ fprintf(stderr,"bad result file: %s (record %llu)\n", path, (unsigned long long)n); rc = -1; continue; }
+        EvalResult R = { r->status==CALCBIN_OK, make_int(0), (size_t)r->err_pos, 0, 0 };
+        if(R.ok) R.v = r->tag==CALCBIN_FLOAT ? make_double(r->v.d) : make_int(r->v.i);
+        char outname[512]; build_output_filename(name, outname, sizeof outname);
+        char res[64]; int len = format_result(res, sizeof res, R);
+        if(write_result(out, outname, res, (size_t)len)!=0) rc = -1;
+    }
+    munmap(map, size);
+    return rc;
+}
+
+// ================================== NDJSON ==================================
+// --ndjson: each input line is a JSON object carrying an "expr" string. The
+// record is echoed with "result" (or "error_pos") appended before its closing
+// brace. The line is scanned once, only far enough to find the top-level
+// "expr" value; the expression is evaluated in place unless it contains
+// escapes, and the only bytes copied are the ones written out.
+typedef struct { char *buf; size_t len, cap; int fd; int err; } OutBuf;
+
+static void ob_flush(OutBuf *b){
+    if(b->len && write_all(b->fd, b->buf, b->len)!=0) b->err = 1;
+    b->len = 0;
+}
+static void ob_put(OutBuf *b, const char *p, size_t n){
+    if(b->len + n > b->cap) ob_flush(b);
+    if(n > b->cap){ if(write_all(b->fd, p, n)!=0) b->err = 1; return; }
+    memcpy(b->buf + b->len, p, n); b->len += n;
+}
+
+static const char *json_skip_ws(const char *p, const char *e){
+    while(p<e && (*p==' ' || *p=='\t' || *p=='\r' || *p=='\n')) p++;
+    return p;
+}
+
+// Skips a string starting at the opening quote; returns the closing quote
+// (or NULL) and whether any backslash escapes were seen
+static const char *json_skip_string(const char *p, const char *e, int *escaped){
+    for(p++; p<e; p++){
+        if(*p=='\\'){ *escaped = 1; p++; }
+        else if(*p=='"') return p;
+    }
+    return NULL;
+}
+
+// Finds the top-level "expr" string value of an object; 0 on success
+static int json_find_expr(const char *p, const char *e, const char **val, size_t *vlen, int *escaped){
+    p = json_skip_ws(p, e);
+    if(p>=e || *p!='{') return -1;
+    int depth = 0, expect_key = 1;
+    for(; p<e; p++){
+        char c = *p;
+        if(c=='"'){
+            int esc = 0;
+            const char *q = json_skip_string(p, e, &esc);
+            if(!q) return -1;
+            if(depth==1 && expect_key){
+                int is_expr = (q - p - 1)==4 && memcmp(p+1, "expr", 4)==0;
+                p = json_skip_ws(q+1, e);
+                if(p>=e || *p!=':') return -1;
+                p = json_skip_ws(p+1, e);
+                if(is_expr){
+                    if(p>=e || *p!='"') return -1;
+                    esc = 0;
+                    q = json_skip_string(p, e, &esc);
+                    if(!q) return -1;
+                    *val = p+1; *vlen = (size_t)(q - p - 1); *escaped = esc;
+                    return 0;
+                }
+                expect_key = 0;
+                p--;   // re-examine the value's first char
+                continue;
+            }
+            p = q;
+        } else if(c=='{' || c=='['){ depth++; expect_key = (c=='{'); }
+        else if(c=='}' || c==']'){ depth--; }
+        else if(c==',' && depth==1){ expect_key = 1; }
+    }
+    return -1;
+}
+
+static void put_utf8(char **o, unsigned long cp){
+    char *d = *o;
+    if(cp < 0x80) *d++ = (char)cp;
+    else if(cp < 0x800){ *d++ = (char)(0xc0 | cp>>6); *d++ = (char)(0x80 | (cp & 0x3f)); }
+    else if(cp < 0x10000){ *d++ = (char)(0xe0 | cp>>12); *d++ = (char)(0x80 | (cp>>6 & 0x3f)); *d++ = (char)(0x80 | (cp & 0x3f)); }
+    else { *d++ = (char)(0xf0 | cp>>18); *d++ = (char)(0x80 | (cp>>12 & 0x3f)); *d++ = (char)(0x80 | (cp>>6 & 0x3f)); *d++ = (char)(0x80 | (cp & 0x3f)); }
+    *o = d;
+}
 
-    char outname[512]; build_output_filename(in_path, outname, sizeof outname);
-    char outpath[1024];
-    if(out_dir && *out_dir) snprintf(outpath,sizeof outpath,"%s/%s",out_dir,outname);
-    else snprintf(outpath,sizeof outpath,"%s",outname);
\ No newline at end of file
+static int hex4(const char *p, const char *e, unsigned long *out){
+    if(e - p < 4) return -1;
+    unsigned long v = 0;
+    for(int i=0;i<4;i++){
+        int c = p[i], d = isdigit(c) ? c-'0' : (c>='a'&&c<='f') ? c-'a'+10 : (c>='A'&&c<='F') ? c-'A'+10 : -1;
+        if(d<0) return -1;
+        v = v<<4 | (unsigned long)d;
+    }
+    *out = v; return 0;
+}
+
+// Decodes JSON string escapes into out (never longer than the input)
+static int json_unescape(const char *p, size_t n, char *out, size_t *out_len){
+    const char *e = p + n; char *o = out;
+    while(p<e){
+        if(*p!='\\'){ *o++ = *p++; continue; }
+        if(++p>=e) return -1;
+        char c = *p++;
+        switch(c){
+            case '"': case '\\': case '/': *o++ = c; break;
+            case 'b': *o++ = '\b'; break;
+            case 'f': *o++ = '\f'; break;
+            case 'n': *o++ = '\n'; break;
+            case 'r': *o++ = '\r'; break;
+            case 't': *o++ = '\t'; break;
+            case 'u': {
+                unsigned long cp, lo;
+                if(hex4(p, e, &cp)) return -1;
+                p += 4;
+                if(cp>=0xd800 && cp<0xdc00 && e-p>=6 && p[0]=='\\' && p[1]=='u' && hex4(p+2, e, &lo)==0 && lo>=0xdc00 && lo<0xe000){
+                    cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+                    p += 6;
+                }
+                put_utf8(&o, cp);
+                break;
+            }
+            default: return -1;
+        }
+    }
+    *out_len = (size_t)(o - out);
+    return 0;
+}
+
+// Handles one line (without its '\n'); returns 0, or -1 if it is not an object.
+// Objects without a usable "expr" string are echoed with an "error" member.
+static int ndjson_record(const char *line, size_t n, OutBuf *ob, char **scratch, size_t *scratch_cap, Agg *agg){
+    const char *e = line + n;
+    while(e>line && (e[-1]==' ' || e[-1]=='\t' || e[-1]=='\r')) e--;
+    if(e==line){ if(!agg) ob_put(ob, "\n", 1); return 0; }   // blank line: kept, so lines stay aligned
+    const char *val; size_t vlen; int escaped;
+    // Only a {...} line is edited; anything else (including a lone "}") is
+    // reported rather than spliced into
+    const char *b = line;
+    while(b<e && (*b==' ' || *b=='\t')) b++;
+    if(*b!='{' || e - b < 2 || e[-1]!='}') return -1;
+    int found = json_find_expr(line, e, &val, &vlen, &escaped)==0;
+    if(found && escaped){
+        if(vlen + 1 > *scratch_cap){
+            char *nb = (char*)mem_realloc(MEM_NDJSON, *scratch, vlen + 1);
+            if(!nb) return -1;
+            *scratch = nb; *scratch_cap = vlen + 1;
+        }
+        if(json_unescape(val, vlen, *scratch, &vlen)!=0) found = 0;
+        (*scratch)[vlen] = '\0';   // strtod scans to a terminator, not to vlen
+        val = *scratch;
+    }
+    EvalResult R = found ? eval_counted(val, vlen) : (EvalResult){0, make_int(0), 0, 0, 0};
+    progress_add(0, n + 1, 1, R);
+    if(agg){ agg_add(agg, R); return 0; }
+
+    // Everything up to the closing brace, then the new member
+    Stamp t = {0}; if(g_instr) t = stamp_now();
+    const char *close = e - 1;
+    const char *last = close;
+    while(last>b+1 && (last[-1]==' ' || last[-1]=='\t' || last[-1]=='\n' || last[-1]=='\r')) last--;
+    char tail[80]; int k;
+    const char *sep = (last[-1]=='{') ? "" : ",";
+    if(!found) k = snprintf(tail, sizeof tail, "%s\"error\":\"no expr\"}\n", sep);
+    else if(!R.ok) k = snprintf(tail, sizeof tail, "%s\"error_pos\":%zu}\n", sep, R.err_pos);
+    else if(R.v.is_float && !isfinite(R.v.d)) k = snprintf(tail, sizeof tail, "%s\"result\":null}\n", sep);
+    else{
+        char num[64]; int m = print_value(num, sizeof num, R.v);
+        k = snprintf(tail, sizeof tail, "%s\"result\":%.*s}\n", sep, m-1, num);
+    }
+    if(g_instr) mark_phase(PH_FORMAT, &t);
+    ob_put(ob, line, (size_t)(last - line));
+    ob_put(ob, tail, (size_t)k);
+    if(g_instr) mark_phase(PH_OUTPUT, &t);
+    return 0;
+}
+
+// Streams NDJSON from path (or stdin when NULL / "-") to stdout, or only
+// folds the results when agg is set
+static int process_ndjson(const char *path, Agg *agg){
+    int fd = (!path || strcmp(path,"-")==0) ? 0 : open(path, O_RDONLY|O_CLOEXEC);
+    if(fd<0){ fprintf(stderr,"read fail: %s\n", path); return 1; }
+    size_t cap = 1<<20, have = 0, lineno = 0;
+    char *buf = (char*)mem_alloc(MEM_NDJSON, cap), *scratch = NULL; size_t scratch_cap = 0;
+    OutBuf ob = { (char*)mem_alloc(MEM_NDJSON, 1<<16), 0, 1<<16, 1, 0 };
+    int rc = 0, eof = 0;
+    if(!buf || !ob.buf){ fprintf(stderr,"out of memory\n"); mem_free(MEM_NDJSON, buf); mem_free(MEM_NDJSON, ob.buf); if(fd>0) close(fd); return 1; }
+    while(!eof || have){
+        if(!eof){
+            if(have==cap){
+                char *nb = (char*)mem_realloc(MEM_NDJSON, buf, cap*2);
+                if(!nb){ fprintf(stderr,"out of memory\n"); rc = 1; break; }
+                buf = nb; cap *= 2;
+            }
+            Stamp t = {0}; if(g_instr) t = stamp_now();
+            ssize_t r = read(fd, buf + have, cap - have);
+            if(g_instr) mark_phase(PH_READ, &t);
+            if(r<0){ if(errno==EINTR) continue; fprintf(stderr,"read fail: %s\n", path ? path : "-"); rc = 1; break; }
+            if(r==0) eof = 1;
+            have += (size_t)r;
+        }
+        // Process every complete line (and the unterminated last one at EOF)
+        double batch_t0 = g_trace_on ? mono_now() : 0;
+        size_t start = 0;
+        for(;;){
+            char *nl = (char*)memchr(buf + start, '\n', have - start);
+            if(!nl && !(eof && start<have)) break;
+            size_t end = nl ? (size_t)(nl - buf) : have;
+            lineno++;
+            double rec_t0 = g_lat_on ? mono_now() : 0;
+            if(g_prof_on) prof_expr_begin();
+            if(g_slow_on) slow_source(NULL, 0, path ? path : "-", lineno);
+            if(ndjson_record(buf + start, end - start, &ob, &scratch, &scratch_cap, agg)!=0){
+                // Still one output line per input line, for consumers that
+                // zip the two streams
+                if(!agg){
+                    char msg[80];
+                    int k = snprintf(msg, sizeof msg, "{\"line\":%zu,\"error\":\"not a JSON object\"}\n", lineno);
+                    ob_put(&ob, msg, (size_t)k);
+                }
+                fprintf(stderr,"not a JSON object at line %zu\n", lineno);
+                rc = 1;
+            }
+            if(g_lat_on) lat_record(LAT_EXPR, rec_t0, mono_now(), NULL, 0, path ? path : "-", lineno);
+            if(g_prof_on) prof_expr_end(NULL, 0, path ? path : "-", lineno);
+            start = nl ? end + 1 : have;
+            if(g_poll_due) poll_work();
+        }
+        if(g_trace_on) trace_span("records", batch_t0, mono_now(), NULL);
+        memmove(buf, buf + start, have - start);
+        have -= start;
+        if(eof) break;
+    }
+    ob_flush(&ob);
+    if(ob.err){ fprintf(stderr,"write fail: stdout\n"); rc = 1; }
+    mem_free(MEM_NDJSON, buf); mem_free(MEM_NDJSON, scratch); mem_free(MEM_NDJSON, ob.buf);
+    if(fd>0) close(fd);
+    return rc;
+}
+
+// ================================== Verify ==================================
+// --verify DIR: every NAME_output.txt in DIR with a NAME.txt next to it is a
+// case. --jobs threads (default: one per online CPU, the main thread being
+// one of them) take case indexes from a shared counter, evaluate the input in
+// memory and compare the result with the expected text, ignoring trailing
+// whitespace. Nothing is written; failures are listed in name order.
+typedef enum { VF_PASS, VF_FAIL, VF_NO_INPUT, VF_READ_FAIL } VerifyStatus;
+
+typedef struct {
+    char *name;                 // NAME, without _output.txt
+    VerifyStatus status;
+    double secs;
+    char got[64], want[64];     // want is cut to fit
+} VerifyCase;
+
+typedef struct { int dirfd; VerifyCase *cases; size_t n; atomic_size_t next; } VerifyRun;
+
+static size_t trim_end(const char *s, size_t n){
+    while(n && isspace((unsigned char)s[n-1])) n--;
+    return n;
+}
+
+static void verify_case(int dirfd, VerifyCase *c){
+    double t0 = mono_now();
+    char path[512], *want, *in;
+    size_t want_len, in_len;
+    snprintf(path, sizeof path, "%s_output.txt", c->name);
+    if(read_entire_file(dirfd, path, &want, &want_len)!=0){ c->status = VF_READ_FAIL; return; }
+    want_len = trim_end(want, want_len);
+    snprintf(c->want, sizeof c->want, "%.*s", (int)want_len, want);
+    snprintf(path, sizeof path, "%s.txt", c->name);
+    if(load_input(dirfd, path, &in, &in_len)!=0){
+        c->status = errno==ENOENT ? VF_NO_INPUT : VF_READ_FAIL;
+        mem_free(MEM_INPUT, want); return;
+    }
+    EvalResult R = eval_buffer(in, in_len);
+    progress_add(1, in_len, 1, R);
+    size_t n = trim_end(c->got, (size_t)format_result(c->got, sizeof c->got, R));
+    c->got[n] = '\0';
+    c->status = (n==want_len && memcmp(c->got, want, n)==0) ? VF_PASS : VF_FAIL;
+    mem_free(MEM_INPUT, in); mem_free(MEM_INPUT, want);
+    c->secs = mono_now() - t0;
+}
+
+// Only the main thread (polls set) runs the periodic work
+static void verify_loop(VerifyRun *run, int polls){
+    for(size_t i; (i = atomic_fetch_add(&run->next, 1)) < run->n; ){
+        verify_case(run->dirfd, &run->cases[i]);
+        if(polls && g_poll_due) poll_work();
+    }
+}
+static void *verify_worker(void *arg){ verify_loop((VerifyRun*)arg, 0); return NULL; }
+
+// Version order (case2 before case10): strverscmp on glibc, else a plain
+// digit-run comparison that agrees with it for names without leading zeros
+static int name_cmp(const char *a, const char *b){
+#ifdef __GLIBC__
+    return strverscmp(a, b);
+#else
+    while(*a && *a==*b && !isdigit((unsigned char)*a)){ a++; b++; }
+    if(isdigit((unsigned char)*a) && isdigit((unsigned char)*b)){
+        const char *x = a, *y = b;
+        while(isdigit((unsigned char)*x)) x++;
+        while(isdigit((unsigned char)*y)) y++;
+        if(x - a != y - b) return (x - a) < (y - b) ? -1 : 1;
+        int c = strncmp(a, b, (size_t)(x - a));
+        return c ? c : name_cmp(x, y);
+    }
+    return (unsigned char)*a - (unsigned char)*b;
+#endif
+}
+
+static int cmp_case(const void *a, const void *b){
+    return name_cmp(((const VerifyCase*)a)->name, ((const VerifyCase*)b)->name);
+}
+
+// Prints s with newlines and quotes escaped
+static void put_quoted(FILE *f, const char *s){
+    fputc('"', f);
+    for(; *s; s++){
+        if(*s=='\n') fputs("\\n", f);
+        else if(*s=='\r') fputs("\\r", f);
+        else if(*s=='"' || *s=='\\'){ fputc('\\', f); fputc(*s, f); }
+        else fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+static int verify_dir(const char *dir, int jobs){
+    DIR *d = opendir(dir);
+    if(!d){ fprintf(stderr,"open dir fail: %s\n", dir); return 1; }
+    VerifyRun run = { dirfd(d), NULL, 0, 0 };
+    size_t cap = 0;
+    struct dirent *e;
+    while((e=readdir(d))!=NULL){
+        if(!ends_with(e->d_name, "_output.txt")) continue;
+        if(run.n==cap){
+            size_t nc = cap ? cap*2 : 256;
+            VerifyCase *nb = (VerifyCase*)mem_realloc(MEM_INPUT, run.cases, nc * sizeof *nb);
+            if(!nb){ fprintf(stderr,"out of memory\n"); break; }
+            run.cases = nb; cap = nc;
+        }
+        VerifyCase *c = &run.cases[run.n];
+        memset(c, 0, sizeof *c);
+        size_t k = strlen(e->d_name) - strlen("_output.txt");
+        if(!(c->name = (char*)mem_alloc(MEM_INPUT, k + 1))){ fprintf(stderr,"out of memory\n"); break; }
+        memcpy(c->name, e->d_name, k); c->name[k] = '\0';
+        run.n++;
+    }
+    qsort(run.cases, run.n, sizeof *run.cases, cmp_case);
+    g_prog_total_files = run.n;
+
+    if(jobs <= 0){ long cpus = sysconf(_SC_NPROCESSORS_ONLN); jobs = cpus > 0 ? (int)cpus : 1; }
+    if((size_t)jobs > run.n) jobs = run.n ? (int)run.n : 1;
+    pthread_t *tids = (pthread_t*)mem_alloc(MEM_INSTR, (size_t)jobs * sizeof *tids);
+    int started = 0;
+    double t0 = mono_now();
+    // Workers leave SIGUSR1/SIGALRM to the main thread, which runs poll_work
+    sigset_t block, old;
+    sigemptyset(&block); sigaddset(&block, SIGUSR1); sigaddset(&block, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+    for(; tids && started < jobs - 1; started++)
+        if(pthread_create(&tids[started], NULL, verify_worker, &run)!=0) break;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    verify_loop(&run, 1);
+    for(int t=0;t<started;t++) pthread_join(tids[t], NULL);
+    double wall = mono_now() - t0;
+    mem_free(MEM_INSTR, tids);
+    closedir(d);
+
+    size_t pass = 0, slowest = 0;
+    for(size_t i=0;i<run.n;i++){
+        VerifyCase *c = &run.cases[i];
+        if(c->secs > run.cases[slowest].secs) slowest = i;
+        switch(c->status){
+        case VF_PASS: pass++; break;
+        case VF_FAIL:
+            printf("FAIL %s: expected ", c->name); put_quoted(stdout, c->want);
+            fputs(", got ", stdout); put_quoted(stdout, c->got); fputc('\n', stdout);
+            break;
+        case VF_NO_INPUT: printf("FAIL %s: no %s.txt\n", c->name, c->name); break;
+        case VF_READ_FAIL: printf("FAIL %s: read fail\n", c->name); break;
+        }
+    }
+    printf("verify: %zu cases, %zu passed, %zu failed in %.1f ms (%d threads, %.0f cases/s)",
+           run.n, pass, run.n - pass, wall * 1e3, started + 1, wall > 0 ? run.n / wall : 0.0);
+    if(run.n) printf("; slowest %s %.3f ms", run.cases[slowest].name, run.cases[slowest].secs * 1e3);
+    putchar('\n');
+    for(size_t i=0;i<run.n;i++) mem_free(MEM_INPUT, run.cases[i].name);
+    mem_free(MEM_INPUT, run.cases);
+    return pass==run.n ? 0 : 1;
+}
+
+int main(int argc, char **argv){
+    Options opt;
+    if(parse_args(argc,argv,&opt)!=0) return 1;
+    if(cpu_select(opt.isa)!=0) return 1;
+    if(opt.cpu_features){ cpu_report(stdout); return 0; }
+    if(opt.check_noalloc) return check_noalloc(1000);
+    g_stats_on = opt.stats;
+    if(opt.perf_counters){
+        if(!g_stats_on) g_stats_on = 1;   // counters are reported per --stats phase
+        hw_open();
+    }
+    if(opt.trace){ g_trace_on = 1; g_trace_t0 = mono_now(); }
+    g_lat_on = opt.latency;
+#ifndef CALC_MEM_SIZE
+    if(opt.mem_stats){ fprintf(stderr,"--mem-stats not supported on this platform\n"); return 1; }
+#endif
+    g_mem_on = opt.mem_stats;
+    if(opt.profile_ops){ g_prof_on = 1; prof_start(); }
+    if(opt.slow_log && slow_open(opt.slow_log)!=0) return 1;
+    if(opt.metrics){
+        g_metrics_path = opt.metrics;
+        if(opt.metrics_interval > 0) g_metrics_every = opt.metrics_interval;
+        g_lat_on = 1;   // feeds the latency histograms
+    }
+    poll_init(opt.progress_interval);
+    if(opt.verify){
+        int rc = verify_dir(opt.verify, opt.jobs);
+        progress_done();
+        if(g_mem_on && mem_print(stderr)!=0) rc = 1;
+        return rc;
+    }
+    g_instr = g_stats_on || g_trace_on || g_lat_on || g_slow_on;
+    if(g_stats_on) g_stats.start = stamp_now();
+    Agg agg;
+    if(opt.aggregate) agg_parse(&agg, opt.aggregate);
+    if(opt.ndjson){
+        g_trace_stages = 0;   // millions of records: one span per read batch instead
+        struct stat st;
+        if(opt.input && strcmp(opt.input,"-")!=0 && stat(opt.input, &st)==0 && S_ISREG(st.st_mode)) g_prog_total_bytes = (unsigned long long)st.st_size;
+        int rc = process_ndjson(opt.input, opt.aggregate ? &agg : NULL);
+        if(opt.aggregate) agg_print(stdout, &agg);
+        if(g_stats_on) stats_print(stderr);
+        if(g_metrics_path && metrics_write()!=0) rc = 1;
+        if(opt.latency) lat_print(stderr);
+        if(g_lat_on) lat_release();
+        if(g_prof_on) prof_print(stderr);
+        if(g_slow_on && slow_close(opt.slow_log)!=0) rc = 1;
+        if(g_trace_on && trace_write(opt.trace)!=0) rc = 1;
+        progress_done();
+        if(g_mem_on && mem_print(stderr)!=0) rc = 1;
+        return rc;
+    }
+
+    char defdir[512]={0};
+    const char *out_path = opt.outdir;
+    if(!out_path){ build_default_outdir(opt.dir? opt.dir : opt.zip? opt.zip : opt.input? opt.input : opt.bin_to_text, defdir, sizeof defdir); out_path = defdir; }
+    OutDir out;
+    if(opt.aggregate && !opt.bin_to_text){   // nothing is written: no output dir
+        memset(&out, 0, sizeof out); out.dir.path = out_path; out.dir.fd = -1;
+    } else if(out_open(&out, out_path, opt.durability)!=0){ fprintf(stderr,"cannot create/access output dir: %s\n", out_path); return 1; }
+    out.if_changed = opt.if_changed;
+    out.binary = opt.binary;
+    out.agg = opt.aggregate ? &agg : NULL;
+    g_metrics_out = &out;
+
+    int rc = 0;
+    g_prog_dir = opt.dir;
+    if(opt.dir) rc = process_dir(opt.dir, &out);
+    if(opt.zip && process_zip(opt.zip, &out)!=0) rc = -1;
+    if(opt.bin_to_text && bin_to_text(opt.bin_to_text, &out)!=0) rc = -1;
+    if(opt.input){
+        DirRef cwd = { NULL, AT_FDCWD };
+        if(process_one_file(&cwd, opt.input, &out)!=0) rc = 1;
+    }
+    Stamp t = {0}; if(g_instr) t = stamp_now();
+    if(out_close(&out)!=0 && rc==0) rc = 1;
+    if(g_instr) mark_phase(PH_OUTPUT, &t);
+    if(opt.if_changed) fprintf(stderr, "outputs: %zu written, %zu unchanged (skipped)\n", out.written, out.skipped);
+    if(opt.aggregate) agg_print(stdout, &agg);
+    if(g_stats_on) stats_print(stderr);
+    if(g_metrics_path && metrics_write()!=0 && rc==0) rc = 1;
+    if(opt.latency) lat_print(stderr);
+    if(g_lat_on) lat_release();
+    if(g_prof_on) prof_print(stderr);
+    if(g_slow_on && slow_close(opt.slow_log)!=0 && rc==0) rc = 1;
+    if(g_trace_on && trace_write(opt.trace)!=0 && rc==0) rc = 1;
+    progress_done();
+    if(g_mem_on && mem_print(stderr)!=0 && rc==0) rc = 1;
+    return rc;
+}
@@ -0,0 +1,628 @@
+// calc_bench: reproducible microbenchmarks for calc's stages
+// Compile with: gcc -O2 -Wall -Wextra -std=c17 -pthread -o calc_bench calc_bench.c -lm
+//   (use the same flags as calc; calc.c is built into this translation unit
+//    with its main renamed, so the static stage functions are measured
+//    exactly as calc compiles them)
+//
+// -----------------------------------------------------------------------------
+// WHAT THIS PROGRAM DOES (brief):
+// - Times skip_ws_and_comments, next_token, scan_number, the parse_* chain
+//   (eval_buffer), print_value, and end-to-end process_one_file on tiny,
+//   medium and huge inputs. All inputs are generated from a fixed seed.
+// - Each benchmark is warmed up, its iteration count is calibrated so one
+//   repetition takes about --min-time, and then it is timed --reps times. The
+//   report gives median/min/mean/stddev ns per op and MB/s.
+// - CLI:
+//   calc_bench [--filter SUBSTR] [--reps N] [--min-time T] [--cpu N]
+//              [--isa LEVEL] [--json OUT.json] [--baseline OLD.json [--threshold PCT]]
+//   calc_bench --adversarial [--filter SUBSTR] [--reps N] [--min-time T]
+//   calc_bench --startup CALC [--runs N] [--target T]
+//   • --json writes the results; a previous run's file is the baseline.
+//   • --baseline compares medians by name; the exit status is 1 if any
+//     benchmark got slower by more than --threshold percent (default 5)
+//     and by more than the noise (3 MADs of the baseline plus 3 of this
+//     run; --json records mad_ns). A suspected regression is measured twice
+//     more and the fastest of the three runs is the one compared.
+//   • --cpu pins the process to one CPU for steadier numbers.
+//   • --startup times exec to exit of the calc binary CALC on a 5-byte input
+//     over --runs runs (default 500) and reports min/median/p90/p99; the
+//     exit status is 1 if the median is over --target. The default 300us
+//     is the budget of the lean one-shot build (calc.c header), so measure
+//     that binary:
+//       gcc -O2 -Wall -Wextra -std=c17 -pthread -static -o calc_static calc.c -lm
+//       ./calc_bench --startup ./calc_static
+//     The default dynamic build pays ~150us more for loading libc/libm;
+//     give it its own --target when comparing dynamic builds.
+//   • --isa forces calc's scanner kernel level (as calc --isa); the default
+//     is the best one the CPU supports.
+//   • --adversarial runs the pathological corpus instead (1M of parens and
+//     '**' towers nested just inside CALC_MAX_DEPTH, plus ones past it that
+//     must stop at the limit, long sign chains, 100k-digit literals,
+//     megabytes of comments, one newline-free line). Each case runs in its own child process with
+//     a time budget (ns per byte), a memory budget (peak RSS growth) and a
+//     linearity check; the exit status is 1 if any case misses one. Crafted
+//     corrupt calc_results.bin headers must be rejected by calcbin_view.
+// -----------------------------------------------------------------------------
+
+#define main calc_main
+#include "calc.c"
+#undef main
+
+#include <sched.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+// ================================= Inputs ===================================
+// Deterministic generators (64-bit LCG, fixed seeds) for the bench inputs
+typedef struct { char *buf; size_t len; } Input;
+
+static unsigned long long g_rng = 0x9e3779b97f4a7c15ULL;
+static unsigned rnd(unsigned n){
+    g_rng = g_rng * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (unsigned)((g_rng >> 33) % n);
+}
+
+static void in_put(Input *in, size_t *cap, const char *s, size_t n){
+    if(in->len + n + 1 > *cap){
+        while(in->len + n + 1 > *cap) *cap = *cap ? *cap*2 : 4096;
+        in->buf = (char*)realloc(in->buf, *cap);
+        if(!in->buf){ fprintf(stderr,"out of memory\n"); exit(1); }
+    }
+    memcpy(in->buf + in->len, s, n); in->len += n; in->buf[in->len] = '\0';
+}
+
+// A valid expression of about len bytes: int/float mix, every operator,
+// shallow parens, the odd comment line
+static Input gen_expr(size_t len, unsigned long long seed){
+    Input in = {0}; size_t cap = 0; char t[64];
+    g_rng = seed;
+    int depth = 0;
+    while(in.len < len){
+        if(rnd(40)==0){ in_put(&in, &cap, "\n# generated\n", 13); }
+        if(depth < 3 && rnd(8)==0){ in_put(&in, &cap, "(", 1); depth++; }
+        // never zero, so a '/' cannot end the evaluation early
+        int n = rnd(3) ? snprintf(t, sizeof t, "%u", 1 + rnd(99999)) : snprintf(t, sizeof t, "%u.%02u", 1 + rnd(999), rnd(100));
+        in_put(&in, &cap, t, (size_t)n);
+        if(depth && rnd(4)==0){ in_put(&in, &cap, ")", 1); depth--; }
+        // ** only with a small literal exponent, so nothing underflows to 0
+        if(rnd(50)==0) in_put(&in, &cap, "**2", 3);
+        static const char *const ops[] = { " + ", " - ", " * ", " / " };
+        in_put(&in, &cap, ops[rnd(4)], 3);
+    }
+    in_put(&in, &cap, "7", 1);
+    while(depth--) in_put(&in, &cap, ")", 1);
+    return in;
+}
+
+static Input gen_comments(size_t len){
+    Input in = {0}; size_t cap = 0;
+    g_rng = 7;
+    static const char line[] = "  \t# a comment line that the scanner has to walk to its end\n", blank[] = "\r\n   \n";
+    while(in.len < len){
+        in_put(&in, &cap, line, sizeof line - 1);
+        if(rnd(3)==0) in_put(&in, &cap, blank, sizeof blank - 1);
+    }
+    return in;
+}
+
+static Input gen_numbers(size_t len){
+    Input in = {0}; size_t cap = 0; char t[64];
+    g_rng = 11;
+    while(in.len < len){
+        int n;
+        switch(rnd(3)){
+        case 0:  n = snprintf(t, sizeof t, "%u ", rnd(1000000000)); break;
+        case 1:  n = snprintf(t, sizeof t, "%u.%u ", rnd(100000), rnd(1000)); break;
+        default: n = snprintf(t, sizeof t, "%u.%ue%u ", rnd(10), rnd(100), rnd(30)); break;
+        }
+        in_put(&in, &cap, t, (size_t)n);
+    }
+    return in;
+}
+
+// =============================== Benchmarks =================================
+// Each runs its operation iters times and returns a value that depends on
+// the work, so nothing is optimized away
+typedef struct Bench Bench;
+struct Bench {
+    const char *name;
+    unsigned long long (*run)(const Bench *b, size_t iters);
+    const Input *in;        // NULL for print_value / process_file
+    size_t bytes;           // processed per op (for MB/s), 0 = n/a
+    const char *file;       // process_file: input name in g_bench_in
+};
+
+static Input g_comments, g_numbers, g_tiny, g_medium, g_huge;
+static DirRef g_bench_in;
+static OutDir g_bench_out;
+static char g_tmpdir[64];
+
+static unsigned long long run_skip(const Bench *b, size_t iters){
+    unsigned long long sink = 0;
+    for(size_t k=0;k<iters;k++){
+        Scanner S; memset(&S,0,sizeof S);
+        S.src = b->in->buf; S.len = b->in->len; S.pos = 1;
+        skip_ws_and_comments(&S);
+        sink += S.idx0;
+    }
+    return sink;
+}
+
+static unsigned long long run_tokens(const Bench *b, size_t iters){
+    unsigned long long sink = 0;
+    for(size_t k=0;k<iters;k++){
+        Scanner S; memset(&S, 0, sizeof S);
+        S.src = b->in->buf; S.len = b->in->len; S.pos = 1;
+        while(next_token(&S).type != T_EOF) sink++;
+    }
+    return sink;
+}
+
+static unsigned long long run_numbers(const Bench *b, size_t iters){
+    unsigned long long sink = 0;
+    for(size_t k=0;k<iters;k++){
+        Scanner S; memset(&S,0,sizeof S);
+        S.src = b->in->buf; S.len = b->in->len; S.pos = 1;
+        for(;;){
+            skip_ws_and_comments(&S);
+            if(S.idx0 >= S.len) break;
+            Token t = scan_number(&S);
+            sink += (unsigned long long)t.i + t.type;
+        }
+    }
+    return sink;
+}
+
+static unsigned long long run_eval(const Bench *b, size_t iters){
+    unsigned long long sink = 0;
+    for(size_t k=0;k<iters;k++){
+        EvalResult R = eval_buffer(b->in->buf, b->in->len);
+        sink += (unsigned long long)R.ok + R.err_pos + (unsigned long long)R.v.i;
+    }
+    return sink;
+}
+
+static Value g_ints[256], g_floats[256];
+
+static unsigned long long run_print(const Bench *b, size_t iters){
+    const Value *v = strstr(b->name, "float") ? g_floats : g_ints;
+    unsigned long long sink = 0;
+    char out[64];
+    for(size_t k=0;k<iters;k++) sink += (unsigned long long)print_value(out, sizeof out, v[k & 255]) + (unsigned char)out[0];
+    return sink;
+}
+
+static unsigned long long run_file(const Bench *b, size_t iters){
+    unsigned long long sink = 0;
+    for(size_t k=0;k<iters;k++) sink += process_one_file(&g_bench_in, b->file, &g_bench_out)==0;
+    return sink;
+}
+
+// ============================ Adversarial inputs ============================
+// Each is about n bytes of one pathological shape
+static Input gen_repeat(const char *head, size_t reps, const char *mid, const char *tail){
+    Input in = {0}; size_t cap = 0;
+    size_t h = strlen(head);
+    for(size_t i=0;i<reps;i++) in_put(&in, &cap, head, h);
+    in_put(&in, &cap, mid, strlen(mid));
+    for(size_t i=0;i<reps && *tail;i++) in_put(&in, &cap, tail, strlen(tail));
+    return in;
+}
+// Copies of group joined by '+' up to n bytes (at least one); frees group
+static Input gen_groups(Input group, size_t n){
+    Input in = {0}; size_t cap = 0;
+    for(size_t i=0; i==0 || in.len + 1 + group.len <= n; i++){
+        if(i) in_put(&in, &cap, "+", 1);
+        in_put(&in, &cap, group.buf, group.len);
+    }
+    free(group.buf);
+    return in;
+}
+static size_t groups_in(size_t glen, size_t n){ return n < glen ? 1 : 1 + (n - glen) / (glen + 1); }
+
+// Nesting just inside CALC_MAX_DEPTH, so the whole input is parsed and
+// evaluated; the *_reject cases nest past it and stop at the limit
+#define ADV_DEPTH (CALC_MAX_DEPTH - 1)
+static Input adv_parens(size_t n){ return gen_groups(gen_repeat("(", ADV_DEPTH, "1", ")"), n); }
+static Input adv_tower(size_t n){ return gen_groups(gen_repeat("1**", ADV_DEPTH, "1", ""), n); }
+static Input adv_parens_reject(size_t n){ return gen_repeat("(", n/2, "1", ")"); }
+static Input adv_tower_reject(size_t n){ return gen_repeat("1**", n/3, "1", ""); }
+static Input adv_unary(size_t n){ return gen_repeat("-+", n/2, "1", ""); }
+static Input adv_digits(size_t n){ return gen_repeat("1", n, "", ""); }
+static Input adv_float_digits(size_t n){ return gen_repeat("1", n, ".5", ""); }
+static Input adv_no_newline(size_t n){ return gen_repeat("1+", n/2, "1", ""); }
+static Input adv_comments(size_t n){
+    Input in = gen_comments(n); size_t cap = in.len + 1;
+    in_put(&in, &cap, "1+2", 3);
+    return in;
+}
+
+// ============================ Timing & reports ==============================
+typedef struct { const char *name; double median, min, mean, stddev, mad, mbs; size_t iters; int reps; } Result;
+
+static volatile unsigned long long g_sink;
+
+static double now_s(void){ struct timespec t; clock_gettime(CLOCK_MONOTONIC, &t); return t.tv_sec + t.tv_nsec*1e-9; }
+
+static int cmp_double(const void *a, const void *b){
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static Result measure(const Bench *b, int reps, double min_time){
+    // Warm up, then grow the iteration count until one repetition is long enough
+    size_t iters = 1;
+    for(;;){
+        double t0 = now_s();
+        g_sink += b->run(b, iters);
+        double dt = now_s() - t0;
+        if(dt >= min_time) break;
+        size_t next = dt > 0 ? (size_t)((double)iters * min_time / dt * 1.2) : iters * 10;
+        iters = next > iters * 10 ? iters * 10 : next > iters ? next : iters + 1;
+    }
+    double *ns = (double*)malloc((size_t)reps * sizeof *ns);
+    if(!ns){ fprintf(stderr,"out of memory\n"); exit(1); }
+    for(int r=0;r<reps;r++){
+        double t0 = now_s();
+        g_sink += b->run(b, iters);
+        ns[r] = (now_s() - t0) * 1e9 / (double)iters;
+    }
+    qsort(ns, (size_t)reps, sizeof *ns, cmp_double);
+    Result res = { b->name, 0, ns[0], 0, 0, 0, 0, iters, reps };
+    res.median = reps % 2 ? ns[reps/2] : (ns[reps/2 - 1] + ns[reps/2]) / 2;
+    for(int r=0;r<reps;r++) res.mean += ns[r] / reps;
+    for(int r=0;r<reps;r++) res.stddev += (ns[r] - res.mean) * (ns[r] - res.mean) / reps;
+    res.stddev = sqrt(res.stddev);
+    // Median absolute deviation: the spread estimate --baseline trusts, as
+    // one slow repetition does not inflate it
+    for(int r=0;r<reps;r++) ns[r] = fabs(ns[r] - res.median);
+    qsort(ns, (size_t)reps, sizeof *ns, cmp_double);
+    res.mad = reps % 2 ? ns[reps/2] : (ns[reps/2 - 1] + ns[reps/2]) / 2;
+    if(b->bytes) res.mbs = (double)b->bytes / res.median * 1e3;   // bytes/ns -> MB/s
+    free(ns);
+    return res;
+}
+
+static int write_json(const char *path, const Result *r, size_t n, int reps){
+    FILE *f = fopen(path, "w");
+    if(!f){ fprintf(stderr,"write fail: %s\n", path); return -1; }
+    fprintf(f, "{\"compiler\":\"%s\",\"reps\":%d,\"benchmarks\":[\n", __VERSION__, reps);
+    for(size_t i=0;i<n;i++)
+        fprintf(f, "%s{\"name\":\"%s\",\"median_ns\":%.3f,\"min_ns\":%.3f,\"mean_ns\":%.3f,\"stddev_ns\":%.3f,\"mad_ns\":%.3f,\"mb_per_s\":%.2f,\"iters\":%zu}",
+                i ? ",\n" : "", r[i].name, r[i].median, r[i].min, r[i].mean, r[i].stddev, r[i].mad, r[i].mbs, r[i].iters);
+    fputs("\n]}\n", f);
+    if(fclose(f)!=0){ fprintf(stderr,"write fail: %s\n", path); return -1; }
+    return 0;
+}
+
+// Looks up field ("median_ns", "mad_ns") for name in a file written by
+// write_json; <0 if absent
+static double baseline_value(const char *json, const char *name, const char *field){
+    char key[128];
+    snprintf(key, sizeof key, "\"name\":\"%s\"", name);
+    const char *p = strstr(json, key);
+    if(!p) return -1;
+    snprintf(key, sizeof key, "\"%s\":", field);
+    const char *m = strstr(p, key);
+    const char *end = strchr(p, '}');
+    if(!m || (end && m > end)) return -1;
+    return strtod(m + strlen(key), NULL);
+}
+
+// A slowdown counts only if it is over the threshold and over the noise:
+// 3 MADs of the baseline and of this run (a baseline without mad_ns gives
+// none of its own)
+static int slower(const Result *r, double old, double old_mad, double threshold){
+    double noise = 3 * ((old_mad > 0 ? old_mad : 0) + r->mad);
+    return 100 * (r->median - old) / old > threshold && r->median - old > noise;
+}
+
+// ============================ Adversarial runs ==============================
+// Each case is timed at n and at n/4: linear work gives a ratio near 4, so a
+// ratio above 8 means something went quadratic. Cases run in a child so a
+// stack overflow is a failed case rather than a dead benchmark.
+typedef struct {
+    const char *name;
+    Input (*gen)(size_t n);
+    size_t n;
+    const char *expect;     // format_result at size n, without the '\n'
+    double ns_per_byte;     // time budget at size n
+    long mem_kb;            // peak RSS growth budget
+} Adversary;
+
+typedef struct { size_t bytes; double ns_full, ns_quarter; long rss_kb; char got[64]; } AdvResult;
+
+static AdvResult adv_measure(const Adversary *a, int reps, double min_time){
+    AdvResult r; memset(&r, 0, sizeof r);
+    Input full = a->gen(a->n), quarter = a->gen(a->n / 4);
+    struct rusage ru; getrusage(RUSAGE_SELF, &ru);
+    long rss0 = ru.ru_maxrss;
+    int k = format_result(r.got, sizeof r.got, eval_buffer(full.buf, full.len));
+    if(k>0 && r.got[k-1]=='\n') r.got[k-1] = '\0';
+    Bench b = { a->name, run_eval, &full, full.len, NULL };
+    r.bytes = full.len;
+    r.ns_full = measure(&b, reps, min_time).median;
+    b.in = &quarter; b.bytes = quarter.len;
+    r.ns_quarter = measure(&b, reps, min_time).median;
+    getrusage(RUSAGE_SELF, &ru);
+    r.rss_kb = ru.ru_maxrss - rss0;
+    free(full.buf); free(quarter.buf);
+    return r;
+}
+
+// Crafted calc_results.bin headers: calcbin_view must accept the first and
+// reject the rest, or --bin-to-text reads past the mapping
+static int check_calcbin(const char *filter){
+    static const struct { const char *name; uint64_t count, names_off; size_t size; int ok; } cases[] = {
+        { "calcbin/valid",          2,                  32 + 48, 32 + 48 + 4, 1 },
+        { "calcbin/truncated",      0,                  32,      16,          0 },
+        { "calcbin/names_in_hdr",   100000,             0,       32,          0 },
+        { "calcbin/names_past_end", 0,                  4096,    64,          0 },
+        { "calcbin/count_too_big",  3,                  32 + 48, 32 + 48 + 4, 0 },
+        { "calcbin/count_overflow", UINT64_MAX / 8 + 1, 32,      64,          0 },
+    };
+    int failed = 0;
+    for(size_t i=0;i<sizeof cases / sizeof *cases;i++){
+        if(filter && !strstr(cases[i].name, filter)) continue;
+        union { CalcBinHeader h; unsigned char b[128]; } f;
+        memset(&f, 0, sizeof f);
+        memcpy(f.h.magic, CALCBIN_MAGIC, 8);
+        f.h.version = CALCBIN_VERSION; f.h.record_size = sizeof(CalcBinRecord);
+        f.h.count = cases[i].count; f.h.names_off = cases[i].names_off;
+        CalcBinView v;
+        int ok = calcbin_view(&v, f.b, cases[i].size)==0;
+        printf("%-20s %s\n", cases[i].name, ok==cases[i].ok ? "ok" : cases[i].ok ? "FAIL: rejected" : "FAIL: accepted");
+        if(ok!=cases[i].ok) failed = 1;
+    }
+    return failed;
+}
+
+static int run_adversarial(const char *filter, int reps, double min_time){
+    char paren_err[32], tower_err[32], paren_ok[32], tower_ok[32];
+    snprintf(paren_ok, sizeof paren_ok, "%zu", groups_in(2 * ADV_DEPTH + 1, 1 << 20));
+    snprintf(tower_ok, sizeof tower_ok, "%zu", groups_in(3 * ADV_DEPTH + 1, 1 << 20));
+    snprintf(paren_err, sizeof paren_err, "ERROR:%d", CALC_MAX_DEPTH + 1);          // the '(' past the limit
+    snprintf(tower_err, sizeof tower_err, "ERROR:%d", 3 * (CALC_MAX_DEPTH + 1) - 1);  // the '**' past it
+    const Adversary cases[] = {
+        { "parens/1M",         adv_parens,        1 << 20, paren_ok,  200, 2048 },
+        { "parens_reject/1M",  adv_parens_reject, 1 << 20, paren_err, 5,   2048 },
+        { "unary_chain/1M",    adv_unary,         1 << 20, "1",       80,  2048 },
+        { "pow_tower/1M",      adv_tower,         1 << 20, tower_ok,  150, 2048 },
+        { "pow_reject/1M",     adv_tower_reject,  1 << 20, tower_err, 5,   2048 },
+        { "int_digits/100K",   adv_digits,        100000,  "inf",     20,  2048 },
+        { "float_digits/100K", adv_float_digits,  100000,  "inf",     20,  2048 },
+        { "comment_lines/4M",  adv_comments,      4 << 20, "3",       5,   2048 },
+        { "no_newline/1M",     adv_no_newline,    1 << 20, "524289",  200, 2048 },
+    };
+    int failed = 0;
+    printf("%-20s %10s %10s %8s %10s %8s  %s\n", "case", "ns/byte", "budget", "n:n/4", "RSS +KB", "budget", "result");
+    for(size_t i=0;i<sizeof cases / sizeof *cases;i++){
+        const Adversary *a = &cases[i];
+        if(filter && !strstr(a->name, filter)) continue;
+        int fds[2];
+        if(pipe(fds)!=0){ fprintf(stderr,"pipe fail: %s\n", strerror(errno)); return 1; }
+        fflush(stdout);
+        pid_t pid = fork();
+        if(pid<0){ fprintf(stderr,"fork fail: %s\n", strerror(errno)); return 1; }
+        if(pid==0){
+            close(fds[0]);
+            AdvResult r = adv_measure(a, reps, min_time);
+            _exit(write_all(fds[1], (const char*)&r, sizeof r)==0 ? 0 : 1);
+        }
+        close(fds[1]);
+        AdvResult r; ssize_t got = read(fds[0], &r, sizeof r);
+        close(fds[0]);
+        int st = 0; waitpid(pid, &st, 0);
+        if(got != (ssize_t)sizeof r){
+            printf("%-20s FAIL: %s\n", a->name, WIFSIGNALED(st) ? strsignal(WTERMSIG(st)) : "no result");
+            failed = 1; continue;
+        }
+        double npb = r.ns_full / (double)r.bytes, ratio = r.ns_quarter > 0 ? r.ns_full / r.ns_quarter : 0;
+        const char *why = strcmp(r.got, a->expect)!=0 ? "wrong result" :
+                          npb > a->ns_per_byte ? "over time budget" :
+                          ratio > 8 ? "superlinear" :
+                          r.rss_kb > a->mem_kb ? "over memory budget" : NULL;
+        printf("%-20s %10.2f %10.2f %8.2f %10ld %8ld  %s%s (%s)\n", a->name, npb, a->ns_per_byte, ratio, r.rss_kb, a->mem_kb,
+               why ? "FAIL: " : "ok", why ? why : "", r.got);
+        if(why) failed = 1;
+    }
+    if(check_calcbin(filter)) failed = 1;
+    fflush(stdout);
+    if(failed) fprintf(stderr, "adversarial: some cases missed their budget\n");
+    return failed;
+}
+
+// ============================== Setup / teardown ============================
+static int write_input(int dirfd, const char *name, const Input *in){
+    int fd = openat(dirfd, name, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+    if(fd<0) return -1;
+    int rc = write_all(fd, in->buf, in->len);
+    close(fd);
+    return rc;
+}
+
+static void remove_tree(const char *path){
+    DIR *d = opendir(path);
+    if(d){
+        struct dirent *e;
+        while((e=readdir(d))!=NULL){
+            if(strcmp(e->d_name,".")==0 || strcmp(e->d_name,"..")==0) continue;
+            unlinkat(dirfd(d), e->d_name, 0);
+        }
+        closedir(d);
+    }
+    rmdir(path);
+}
+
+static int setup_files(void){
+    snprintf(g_tmpdir, sizeof g_tmpdir, "/tmp/calc_bench.XXXXXX");
+    if(!mkdtemp(g_tmpdir)){ fprintf(stderr,"cannot create temp dir\n"); return -1; }
+    static char in_path[96], out_path[96];
+    snprintf(in_path, sizeof in_path, "%s/in", g_tmpdir);
+    snprintf(out_path, sizeof out_path, "%s/out", g_tmpdir);
+    if(mkdir(in_path, 0755)!=0) return -1;
+    int fd = open(in_path, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if(fd<0) return -1;
+    g_bench_in.path = in_path; g_bench_in.fd = fd;
+    if(write_input(fd, "tiny.txt", &g_tiny) || write_input(fd, "medium.txt", &g_medium) || write_input(fd, "huge.txt", &g_huge)) return -1;
+    return out_open(&g_bench_out, out_path, DUR_NONE);
+}
+
+static void teardown_files(void){
+    out_close(&g_bench_out);
+    if(g_bench_in.fd>=0) close(g_bench_in.fd);
+    char p[96];
+    snprintf(p, sizeof p, "%s/in", g_tmpdir); remove_tree(p);
+    snprintf(p, sizeof p, "%s/out", g_tmpdir); remove_tree(p);
+    rmdir(g_tmpdir);
+}
+
+// ================================= Startup ==================================
+// --startup CALC: exec-to-exit time of `CALC tiny.txt -o OUT` on the 5-byte
+// input, the whole cost for callers that run calc once per expression.
+// posix_spawn keeps the bench's own fork out of the number.
+static int run_startup(const char *calc, int runs, double target){
+    char in[128], out[128];
+    snprintf(in, sizeof in, "%s/tiny.txt", g_bench_in.path);
+    snprintf(out, sizeof out, "%s", g_bench_out.dir.path);
+    char *args[] = { (char*)calc, in, "-o", out, NULL };
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_addopen(&fa, 1, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&fa, 2, "/dev/null", O_WRONLY, 0);
+    double *us = (double*)malloc((size_t)runs * sizeof *us);
+    if(!us){ fprintf(stderr,"out of memory\n"); return 1; }
+    int rc = 0;
+    for(int r=-runs/10; r<runs && !rc; r++){   // the first tenth warms the page cache
+        double t0 = now_s();
+        pid_t pid; int st = 0;
+        if(posix_spawn(&pid, calc, &fa, NULL, args, environ)!=0){ fprintf(stderr,"spawn fail: %s\n", calc); rc = 1; break; }
+        waitpid(pid, &st, 0);
+        if(!WIFEXITED(st) || WEXITSTATUS(st)!=0){ fprintf(stderr,"%s failed on %s\n", calc, in); rc = 1; break; }
+        if(r >= 0) us[r] = (now_s() - t0) * 1e6;
+    }
+    posix_spawn_file_actions_destroy(&fa);
+    if(!rc){
+        qsort(us, (size_t)runs, sizeof *us, cmp_double);
+        double med = us[runs/2];
+        printf("startup %s: min %.0f us, median %.0f us, p90 %.0f us, p99 %.0f us (%d runs); target %.0f us: %s\n",
+               calc, us[0], med, us[runs*9/10], us[runs*99/100], runs, target*1e6, med <= target*1e6 ? "ok" : "OVER");
+        rc = med > target*1e6;
+    }
+    free(us);
+    return rc;
+}
+
+int main(int argc, char **argv){
+    const char *filter = NULL, *json = NULL, *baseline = NULL;
+    const char *isa = NULL, *startup = NULL;
+    int reps = 15, cpu = -1, adversarial = 0, runs = 500;
+    double min_time = 0.02, threshold = 5, target = 300e-6;
+    for(int i=1;i<argc;i++){
+        const char *a = argv[i], *v = i+1<argc ? argv[i+1] : NULL;
+        if(strcmp(a,"--filter")==0 && v){ filter = v; i++; }
+        else if(strcmp(a,"--reps")==0 && v && atoi(v)>0){ reps = atoi(v); i++; }
+        else if(strcmp(a,"--min-time")==0 && v && parse_duration(v, &min_time)==0){ i++; }
+        else if(strcmp(a,"--cpu")==0 && v){ cpu = atoi(v); i++; }
+        else if(strcmp(a,"--json")==0 && v){ json = v; i++; }
+        else if(strcmp(a,"--baseline")==0 && v){ baseline = v; i++; }
+        else if(strcmp(a,"--threshold")==0 && v){ threshold = atof(v); i++; }
+        else if(strcmp(a,"--adversarial")==0) adversarial = 1;
+        else if(strcmp(a,"--isa")==0 && v){ isa = v; i++; }
+        else if(strcmp(a,"--startup")==0 && v){ startup = v; i++; }
+        else if(strcmp(a,"--runs")==0 && v && atoi(v)>0){ runs = atoi(v); i++; }
+        else if(strcmp(a,"--target")==0 && v && parse_duration(v, &target)==0){ i++; }
+        else {
+            fprintf(stderr, "Usage: %s [--filter SUBSTR] [--reps N] [--min-time T] [--cpu N]\n"
+                            "          [--isa LEVEL] [--json OUT.json] [--baseline OLD.json [--threshold PCT]]\n"
+                            "       %s --adversarial [--filter SUBSTR] [--reps N] [--min-time T] [--cpu N]\n"
+                            "       %s --startup CALC [--runs N] [--target T] [--cpu N]\n", argv[0], argv[0], argv[0]);
+            return 1;
+        }
+    }
+    if(cpu >= 0){
+        cpu_set_t set; CPU_ZERO(&set); CPU_SET(cpu, &set);
+        if(sched_setaffinity(0, sizeof set, &set)!=0) fprintf(stderr, "cannot pin to cpu %d\n", cpu);
+    }
+    if(cpu_select(isa)!=0) return 1;
+    printf("kernels: %s\n", isa_names[g_isa]);
+    if(adversarial) return run_adversarial(filter, reps, min_time);
+
+    g_comments = gen_comments(64 << 10);
+    g_numbers  = gen_numbers(64 << 10);
+    g_tiny     = gen_expr(5, 1);
+    g_medium   = gen_expr(4 << 10, 2);
+    g_huge     = gen_expr(4 << 20, 3);
+    g_rng = 5;
+    for(int i=0;i<256;i++){
+        g_ints[i] = make_int((long long)rnd(2000000000) - 1000000000);
+        g_floats[i] = make_double(((double)rnd(1000000) - 500000) / ((double)rnd(997) + 3));
+    }
+    const Input *exprs[] = { &g_tiny, &g_medium, &g_huge };
+    for(size_t i=0;i<3;i++){
+        EvalResult R = eval_buffer(exprs[i]->buf, exprs[i]->len);
+        if(!R.ok){ fprintf(stderr,"generated input %zu does not evaluate (ERROR:%zu)\n", i, R.err_pos); return 1; }
+    }
+    Scanner S; memset(&S,0,sizeof S);
+    S.src = g_comments.buf; S.len = g_comments.len; S.pos = 1;
+    skip_ws_and_comments(&S);
+    if(S.idx0 != S.len){ fprintf(stderr,"generated comment input is not all comments\n"); return 1; }
+    if(setup_files()!=0){ fprintf(stderr,"bench setup failed in %s\n", g_tmpdir); teardown_files(); return 1; }
+    if(startup){
+        int rc = run_startup(startup, runs, target);
+        teardown_files();
+        return rc;
+    }
+
+    const Bench benches[] = {
+        { "skip_ws_and_comments/64K", run_skip,    &g_comments, 0, NULL },
+        { "next_token/medium",        run_tokens,  &g_medium,   0, NULL },
+        { "scan_number/64K",          run_numbers, &g_numbers,  0, NULL },
+        { "parse_eval/tiny",          run_eval,    &g_tiny,     0, NULL },
+        { "parse_eval/medium",        run_eval,    &g_medium,   0, NULL },
+        { "parse_eval/huge",          run_eval,    &g_huge,     0, NULL },
+        { "print_value/int",          run_print,   NULL,        0, NULL },
+        { "print_value/float",        run_print,   NULL,        0, NULL },
+        { "process_file/tiny",        run_file,    &g_tiny,     0, "tiny.txt" },
+        { "process_file/medium",      run_file,    &g_medium,   0, "medium.txt" },
+        { "process_file/huge",        run_file,    &g_huge,     0, "huge.txt" },
+    };
+    const size_t nb = sizeof benches / sizeof *benches;
+    Result res[sizeof benches / sizeof *benches];
+    size_t nres = 0;
+
+    char *base = NULL; size_t base_len = 0;
+    if(baseline && read_entire_file(AT_FDCWD, baseline, &base, &base_len)!=0){
+        fprintf(stderr,"read fail: %s\n", baseline); teardown_files(); return 1;
+    }
+    int regressed = 0;
+    printf("%-26s %12s %12s %10s %10s %10s\n", "benchmark", "median ns", "min ns", "stddev %", "MB/s", "vs base");
+    for(size_t i=0;i<nb;i++){
+        Bench b = benches[i];
+        if(filter && !strstr(b.name, filter)) continue;
+        if(b.in) b.bytes = b.in->len;
+        Result r = measure(&b, reps, min_time);
+        double old = base ? baseline_value(base, r.name, "median_ns") : -1;
+        double old_mad = base ? baseline_value(base, r.name, "mad_ns") : -1;
+        // A suspected regression is measured twice more and the fastest run
+        // kept, so one disturbed run does not fail the comparison
+        for(int again=0; again<2 && old > 0 && slower(&r, old, old_mad, threshold); again++){
+            Result r2 = measure(&b, reps, min_time);
+            if(r2.median < r.median) r = r2;
+        }
+        res[nres++] = r;
+        printf("%-26s %12.1f %12.1f %10.1f ", r.name, r.median, r.min, r.median > 0 ? 100 * r.stddev / r.mean : 0.0);
+        if(r.mbs > 0) printf("%10.1f ", r.mbs); else printf("%10s ", "-");
+        if(old > 0){
+            double pct = 100 * (r.median - old) / old;
+            int bad = slower(&r, old, old_mad, threshold);
+            printf("%+9.1f%%%s\n", pct, bad ? "  REGRESSION" : "");
+            if(bad) regressed = 1;
+        } else printf("%10s\n", "-");
+    }
+    teardown_files();
+    free(base);
+    if(json && write_json(json, res, nres, reps)!=0) return 1;
+    if(regressed) fprintf(stderr, "regression: some benchmarks are more than %.1f%% slower than %s\n", threshold, baseline);
+    return regressed;
+}
@@ -0,0 +1,285 @@
+// calc_gen: deterministic synthetic workloads for calc
+// Compile with: gcc -O2 -Wall -Wextra -std=c17 -o calc_gen calc_gen.c -lm
+//
+// -----------------------------------------------------------------------------
+// WHAT THIS PROGRAM DOES (brief):
+// - Generates arithmetic expressions in calc's language. The same seed and
+//   options always give byte-identical output.
+// - Output is one of:
+//     --dir OUT      one expression per OUT/gen_NNNNNNN.txt (calc -d / --zip)
+//     --file OUT     all --count expressions joined by '+' into one
+//                    expression (calc input.txt, the huge-file case)
+//     --ndjson OUT   one {"id":N,"expr":"..."} record per line (calc --ndjson)
+//   OUT may be '-' for stdout with --file / --ndjson.
+// - Knobs:
+//   --seed N           (1)      --count N        (1000) expressions
+//   --size BYTES       (64)     mean expression size
+//   --size-dist const|uniform|pareto (const); pareto gives a heavy tail of
+//                      a few huge expressions among many small ones
+//   --depth N          (3)      maximum paren nesting
+//   --ops add=4,sub=4,mul=3,div=2,pow=1   relative operator weights
+//   --float-ratio F    (0.3)    share of float literals
+//   --unary-rate F     (0.05)   chance of a unary sign before an operand
+//   --comment-rate F   (0.02)   chance of a '#' comment line between tokens
+//   --error-rate F     (0)      share of expressions with an injected error
+//                               (syntax error or division by zero)
+// - A summary (expressions, bytes, injected errors) goes to stderr.
+// -----------------------------------------------------------------------------
+
+#define _GNU_SOURCE   // openat, O_DIRECTORY
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+// ================================== Random ==================================
+// splitmix64: small, fast, and identical on every platform
+static unsigned long long g_state;
+static unsigned long long next64(void){
+    unsigned long long z = (g_state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+static unsigned rnd(unsigned n){ return (unsigned)(next64() % n); }
+static double rnd01(void){ return (double)(next64() >> 11) / 9007199254740992.0; }
+static int chance(double p){ return p > 0 && rnd01() < p; }
+
+// ================================== Options =================================
+enum { OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_POW, OP_N };
+static const char *const op_names[OP_N] = { "add", "sub", "mul", "div", "pow" };
+static const char *const op_text[OP_N]  = { " + ", " - ", " * ", " / ", "**" };
+
+typedef enum { SIZE_CONST, SIZE_UNIFORM, SIZE_PARETO } SizeDist;
+
+typedef struct {
+    const char *dir, *file, *ndjson;
+    unsigned long long seed, count;
+    size_t size; SizeDist dist;
+    int depth;
+    unsigned op_weight[OP_N], op_total;
+    double float_ratio, unary_rate, comment_rate, error_rate;
+} Options;
+
+static void usage(const char *prog){
+    fprintf(stderr,
+      "Usage: %s (--dir OUT | --file OUT | --ndjson OUT) [--seed N] [--count N]\n"
+      "          [--size BYTES] [--size-dist const|uniform|pareto] [--depth N]\n"
+      "          [--ops add=W,sub=W,mul=W,div=W,pow=W] [--float-ratio F]\n"
+      "          [--unary-rate F] [--comment-rate F] [--error-rate F]\n", prog);
+}
+
+static int parse_ops(const char *s, Options *o){
+    memset(o->op_weight, 0, sizeof o->op_weight);
+    while(*s){
+        int k = 0;
+        for(; k<OP_N; k++){ size_t n = strlen(op_names[k]); if(strncmp(s, op_names[k], n)==0 && s[n]=='='){ s += n + 1; break; } }
+        if(k==OP_N) return -1;
+        char *end; unsigned long w = strtoul(s, &end, 10);
+        if(end==s) return -1;
+        o->op_weight[k] = (unsigned)w; s = end;
+        if(*s==',') s++; else if(*s) return -1;
+    }
+    o->op_total = 0;
+    for(int k=0;k<OP_N;k++) o->op_total += o->op_weight[k];
+    return o->op_total ? 0 : -1;
+}
+
+static int parse_rate(const char *s, double *out){
+    char *end; double v = strtod(s, &end);
+    if(end==s || *end || v < 0 || v > 1) return -1;
+    *out = v; return 0;
+}
+
+static int parse_args(int argc, char **argv, Options *o){
+    memset(o, 0, sizeof *o);
+    o->seed = 1; o->count = 1000; o->size = 64; o->dist = SIZE_CONST; o->depth = 3;
+    o->float_ratio = 0.3; o->unary_rate = 0.05; o->comment_rate = 0.02;
+    parse_ops("add=4,sub=4,mul=3,div=2,pow=1", o);
+    for(int i=1;i<argc;i++){
+        const char *a = argv[i], *v = i+1<argc ? argv[i+1] : NULL;
+        if(!v){ usage(argv[0]); return -1; }
+        i++;
+        if(strcmp(a,"--dir")==0) o->dir = v;
+        else if(strcmp(a,"--file")==0) o->file = v;
+        else if(strcmp(a,"--ndjson")==0) o->ndjson = v;
+        else if(strcmp(a,"--seed")==0) o->seed = strtoull(v, NULL, 10);
+        else if(strcmp(a,"--count")==0) o->count = strtoull(v, NULL, 10);
+        else if(strcmp(a,"--size")==0 && atol(v) > 0) o->size = (size_t)atol(v);
+        else if(strcmp(a,"--size-dist")==0 && strcmp(v,"const")==0) o->dist = SIZE_CONST;
+        else if(strcmp(a,"--size-dist")==0 && strcmp(v,"uniform")==0) o->dist = SIZE_UNIFORM;
+        else if(strcmp(a,"--size-dist")==0 && strcmp(v,"pareto")==0) o->dist = SIZE_PARETO;
+        else if(strcmp(a,"--depth")==0 && atoi(v) >= 0) o->depth = atoi(v);
+        else if(strcmp(a,"--ops")==0 && parse_ops(v, o)==0) {}
+        else if(strcmp(a,"--float-ratio")==0 && parse_rate(v, &o->float_ratio)==0) {}
+        else if(strcmp(a,"--unary-rate")==0 && parse_rate(v, &o->unary_rate)==0) {}
+        else if(strcmp(a,"--comment-rate")==0 && parse_rate(v, &o->comment_rate)==0) {}
+        else if(strcmp(a,"--error-rate")==0 && parse_rate(v, &o->error_rate)==0) {}
+        else { usage(argv[0]); return -1; }
+    }
+    if(!!o->dir + !!o->file + !!o->ndjson != 1){ usage(argv[0]); return -1; }
+    return 0;
+}
+
+// ================================= Generator ================================
+// Expressions are built in a growable buffer. Operands are literals or, below
+// --depth, parenthesized sub-expressions; ** only takes a small literal
+// exponent and literals are never 0, so only injected errors produce ERROR
+// (apart from the rare sub-expression that cancels to 0 under a '/').
+typedef struct { char *p; size_t len, cap; } Buf;
+
+static void put(Buf *b, const char *s, size_t n){
+    if(b->len + n + 1 > b->cap){
+        size_t nc = b->cap ? b->cap : 256;
+        while(b->len + n + 1 > nc) nc *= 2;
+        char *np = (char*)realloc(b->p, nc);
+        if(!np){ fprintf(stderr,"out of memory\n"); exit(1); }
+        b->p = np; b->cap = nc;
+    }
+    memcpy(b->p + b->len, s, n); b->len += n; b->p[b->len] = '\0';
+}
+static void puts_(Buf *b, const char *s){ put(b, s, strlen(s)); }
+
+static const Options *g_opt;
+
+static int pick_op(void){
+    unsigned r = rnd(g_opt->op_total);
+    for(int k=0;k<OP_N;k++){ if(r < g_opt->op_weight[k]) return k; r -= g_opt->op_weight[k]; }
+    return OP_ADD;
+}
+
+static void gen_literal(Buf *b){
+    char t[48]; int n;
+    if(chance(g_opt->float_ratio)){
+        switch(rnd(4)){
+        case 0:  n = snprintf(t, sizeof t, "%u.%03ue%u", 1 + rnd(9), rnd(1000), rnd(6)); break;
+        default: n = snprintf(t, sizeof t, "%u.%0*u", 1 + rnd(9999), 1 + (int)rnd(4), rnd(10000) % 10000); break;
+        }
+    } else n = snprintf(t, sizeof t, "%u", 1 + rnd(rnd(4) ? 1000 : 1000000000));
+    put(b, t, (size_t)n);
+}
+
+static void gen_sum(Buf *b, size_t budget, int depth);
+
+static void gen_operand(Buf *b, size_t budget, int depth){
+    if(chance(g_opt->unary_rate)) puts_(b, rnd(2) ? "-" : "+");
+    if(depth < g_opt->depth && budget > 16 && rnd(4)==0){
+        puts_(b, "(");
+        gen_sum(b, budget / 2, depth + 1);
+        puts_(b, ")");
+    } else gen_literal(b);
+}
+
+// Appends operand (op operand)* until about budget more bytes are written
+static void gen_sum(Buf *b, size_t budget, int depth){
+    size_t start = b->len;
+    gen_operand(b, budget, depth);
+    while(b->len - start < budget){
+        if(chance(g_opt->comment_rate)) puts_(b, "\n# generated comment\n");
+        int op = pick_op();
+        puts_(b, op_text[op]);
+        if(op==OP_POW){ puts_(b, rnd(2) ? "2" : "3"); continue; }
+        size_t used = b->len - start;   // the op just written may overshoot
+        gen_operand(b, used < budget ? budget - used : 1, depth);
+    }
+}
+
+static size_t draw_size(void){
+    double mean = (double)g_opt->size;
+    switch(g_opt->dist){
+    case SIZE_UNIFORM: return 1 + (size_t)(rnd01() * 2 * mean);
+    case SIZE_PARETO: {   // alpha 1.5: mean = 3 * xmin
+        double x = mean / 3 / pow(1 - rnd01(), 1 / 1.5);
+        return x > 1e9 ? (size_t)1e9 : 1 + (size_t)x;
+    }
+    default: return g_opt->size;
+    }
+}
+
+// Generates one expression into b (cleared first); returns 1 if an error was injected
+static int gen_expression(Buf *b){
+    b->len = 0; put(b, "", 0);
+    gen_sum(b, draw_size(), 0);
+    if(!chance(g_opt->error_rate)) return 0;
+    switch(rnd(4)){
+    case 0:  puts_(b, " / 0"); break;   // division by zero
+    case 1:  puts_(b, " *"); break;     // missing operand
+    case 2:  puts_(b, ")"); break;      // stray paren
+    default: puts_(b, " $"); break;     // invalid character
+    }
+    return 1;
+}
+
+// ================================== Output ==================================
+static int write_all(int fd, const char *p, size_t n){
+    while(n){
+        ssize_t w = write(fd, p, n);
+        if(w<0){ if(errno==EINTR) continue; return -1; }
+        p += w; n -= (size_t)w;
+    }
+    return 0;
+}
+
+static void json_escaped(Buf *out, const char *s, size_t n){
+    for(size_t i=0;i<n;i++){
+        if(s[i]=='\n') puts_(out, "\\n");
+        else if(s[i]=='"' || s[i]=='\\'){ char t[2] = { '\\', s[i] }; put(out, t, 2); }
+        else put(out, s + i, 1);
+    }
+}
+
+int main(int argc, char **argv){
+    Options opt;
+    if(parse_args(argc, argv, &opt)!=0) return 1;
+    g_opt = &opt; g_state = opt.seed;
+    Buf e = {0}, out = {0};
+    unsigned long long bytes = 0, errors = 0;
+    int rc = 0;
+
+    if(opt.dir){
+        if(mkdir(opt.dir, 0755)!=0 && errno!=EEXIST){ fprintf(stderr,"cannot create dir: %s\n", opt.dir); return 1; }
+        int dfd = open(opt.dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+        if(dfd<0){ fprintf(stderr,"cannot open dir: %s\n", opt.dir); return 1; }
+        for(unsigned long long i=0; i<opt.count && !rc; i++){
+            errors += (unsigned long long)gen_expression(&e);
+            char name[64]; snprintf(name, sizeof name, "gen_%07llu.txt", i);
+            int fd = openat(dfd, name, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+            if(fd<0 || write_all(fd, e.p, e.len)!=0){ fprintf(stderr,"write fail: %s/%s\n", opt.dir, name); rc = 1; }
+            if(fd>=0) close(fd);
+            bytes += e.len;
+        }
+        close(dfd);
+    } else {
+        const char *path = opt.file ? opt.file : opt.ndjson;
+        int fd = strcmp(path,"-")==0 ? 1 : open(path, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+        if(fd<0){ fprintf(stderr,"write fail: %s\n", path); return 1; }
+        for(unsigned long long i=0; i<opt.count && !rc; i++){
+            errors += (unsigned long long)gen_expression(&e);
+            bytes += e.len;
+            if(opt.ndjson){
+                char head[48]; int n = snprintf(head, sizeof head, "{\"id\":%llu,\"expr\":\"", i);
+                put(&out, head, (size_t)n);
+                json_escaped(&out, e.p, e.len);
+                puts_(&out, "\"}\n");
+            } else {
+                if(i) puts_(&out, "\n+ ");
+                put(&out, e.p, e.len);
+            }
+            if(out.len >= (1u << 20) || i + 1 == opt.count){
+                if(write_all(fd, out.p, out.len)!=0){ fprintf(stderr,"write fail: %s\n", path); rc = 1; }
+                out.len = 0;
+            }
+        }
+        if(fd!=1) close(fd);
+    }
+    fprintf(stderr, "calc_gen: seed %llu, %llu expressions, %llu bytes, %llu with injected errors\n",
+            opt.seed, opt.count, bytes, errors);
+    free(e.p); free(out.p);
+    return rc;
+}
@@ -0,0 +1,79 @@
+// Ilkim Sonal 211ADB102
+// calcbin.h - binary result format written by `calc --format bin`.
+//
+// One file holds the results of a whole run, so consumers can mmap it and
+// index record N directly instead of re-parsing text with strtod:
+//   offset 0                header   CalcBinHeader (32 bytes)
+//   offset 32 + 24*N        record N CalcBinRecord (24 bytes)
+//   offset header.names_off names    NUL-terminated input names;
+//                                    record.name_off is relative to names_off
+// Fields are in host byte order; a reader on the other endianness sees a
+// byte-swapped version and rejects the file.
+// `calc --bin-to-text FILE` converts a file back to the usual text outputs.
+#ifndef CALCBIN_H
+#define CALCBIN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define CALCBIN_MAGIC   "CALCRES"          // 8 bytes including the NUL
+#define CALCBIN_VERSION 1u
+#define CALCBIN_FILE    "calc_results.bin" // name used inside the output dir
+
+enum { CALCBIN_OK = 0, CALCBIN_ERROR = 1 };   // record.status
+enum { CALCBIN_INT = 0, CALCBIN_FLOAT = 1 };  // record.tag (valid when OK)
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t record_size;   // sizeof(CalcBinRecord)
+    uint64_t count;         // number of records
+    uint64_t names_off;     // file offset of the name table
+} CalcBinHeader;
+
+typedef struct {
+    uint8_t  status;        // CALCBIN_OK / CALCBIN_ERROR
+    uint8_t  tag;           // CALCBIN_INT / CALCBIN_FLOAT
+    uint16_t reserved;
+    uint32_t name_off;      // input name, relative to header.names_off
+    union { int64_t i; double d; } v;
+    uint64_t err_pos;       // 1-based error position (status == ERROR)
+} CalcBinRecord;
+
+_Static_assert(sizeof(CalcBinHeader) == 32, "calcbin header layout");
+_Static_assert(sizeof(CalcBinRecord) == 24, "calcbin record layout");
+
+// ------------------------------ Reader --------------------------------------
+// Read-only view over a file's bytes (typically mmap'ed)
+typedef struct {
+    const unsigned char *base; size_t size;
+    const CalcBinHeader *hdr;
+} CalcBinView;
+
+// Validates the header and bounds; returns 0 on success
+static inline int calcbin_view(CalcBinView *v, const void *data, size_t size){
+    const CalcBinHeader *h = (const CalcBinHeader*)data;
+    if(size < sizeof *h || memcmp(h->magic, CALCBIN_MAGIC, 8)!=0) return -1;
+    if(h->version != CALCBIN_VERSION || h->record_size != sizeof(CalcBinRecord)) return -1;
+    // header + count records <= names_off <= size, without overflow
+    if(h->names_off < sizeof *h || h->names_off > size) return -1;
+    if(h->count > (h->names_off - sizeof *h) / sizeof(CalcBinRecord)) return -1;
+    v->base = (const unsigned char*)data; v->size = size; v->hdr = h;
+    return 0;
+}
+
+static inline const CalcBinRecord *calcbin_record(const CalcBinView *v, uint64_t n){
+    if(n >= v->hdr->count) return NULL;
+    return (const CalcBinRecord*)(v->base + sizeof(CalcBinHeader)) + n;
+}
+
+// Name of a record's input, or NULL if the offset is out of range
+static inline const char *calcbin_name(const CalcBinView *v, const CalcBinRecord *r){
+    size_t avail = v->size - v->hdr->names_off;
+    if(r->name_off >= avail) return NULL;
+    const char *s = (const char*)v->base + v->hdr->names_off + r->name_off;
+    return memchr(s, '\0', avail - r->name_off) ? s : NULL;
+}
+
+#endif